@@ -41,34 +41,55 @@ SOURCES += main.cpp\
     util.cpp \
     polygonstyledialog.cpp \
     svgdialog.cpp \
-    attributedialog.cpp
+    attributedialog.cpp \
+    ../../main/base/cartotype_mapped_file.cpp
 
 HEADERS  += mainwindow.h \
     ../../main/base/cartotype_address.h \
     ../../main/base/cartotype_arithmetic.h \
     ../../main/base/cartotype_array.h \
     ../../main/base/cartotype_base.h \
+    ../../main/base/cartotype_batch_transform.h \
+    ../../main/base/cartotype_best_route.h \
     ../../main/base/cartotype_bidi.h \
     ../../main/base/cartotype_bitmap.h \
     ../../main/base/cartotype_cache.h \
+    ../../main/base/cartotype_cch.h \
     ../../main/base/cartotype_char.h \
     ../../main/base/cartotype_color.h \
+    ../../main/base/cartotype_compact_graph.h \
     ../../main/base/cartotype_epsg.h \
     ../../main/base/cartotype_errors.h \
     ../../main/base/cartotype_expression.h \
+    ../../main/base/cartotype_fast_projection.h \
     ../../main/base/cartotype_find_param.h \
     ../../main/base/cartotype_framework.h \
+    ../../main/base/cartotype_fuzzy_index.h \
+    ../../main/base/cartotype_geometry_arena.h \
+    ../../main/base/cartotype_geometry_pipeline.h \
     ../../main/base/cartotype_graph.h \
     ../../main/base/cartotype_graphics_context.h \
+    ../../main/base/cartotype_incremental_search.h \
     ../../main/base/cartotype_image_server_helper.h \
     ../../main/base/cartotype_internet.h \
+    ../../main/base/cartotype_isochrone.h \
     ../../main/base/cartotype_iter.h \
+    ../../main/base/cartotype_landmarks.h \
     ../../main/base/cartotype_legend.h \
     ../../main/base/cartotype_list.h \
+    ../../main/base/cartotype_map_matcher.h \
     ../../main/base/cartotype_map_object.h \
+    ../../main/base/cartotype_mapped_file.h \
     ../../main/base/cartotype_navigation.h \
+    ../../main/base/cartotype_parallel.h \
     ../../main/base/cartotype_path.h \
+    ../../main/base/cartotype_reverse_geocoder.h \
     ../../main/base/cartotype_road_type.h \
+    ../../main/base/cartotype_route_summary.h \
+    ../../main/base/cartotype_rtree.h \
+    ../../main/base/cartotype_snapshot.h \
+    ../../main/base/cartotype_speed_overrides.h \
+    ../../main/base/cartotype_speed_profile.h \
     ../../main/base/cartotype_stack_allocator.h \
     ../../main/base/cartotype_stream.h \
     ../../main/base/cartotype_string.h \
@@ -0,0 +1,425 @@
+/*
+CARTOTYPE_BATCH_TRANSFORM.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_BATCH_TRANSFORM_H__
+#define CARTOTYPE_BATCH_TRANSFORM_H__
+
+#include <cartotype_transform.h>
+#include <cartotype_path.h>
+#include <cartotype_arithmetic.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__)) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define CARTOTYPE_BATCH_TRANSFORM_SSE2
+    #include <emmintrin.h>
+    #if defined(__GNUC__) || defined(__clang__)
+        // The AVX functions are compiled for AVX whatever the target, and used only if the processor supports it.
+        #define CARTOTYPE_BATCH_TRANSFORM_AVX
+        #define CARTOTYPE_BATCH_TRANSFORM_AVX_TARGET __attribute__((target("avx")))
+        #include <immintrin.h>
+    #elif defined(_MSC_VER) && defined(__AVX__)
+        #define CARTOTYPE_BATCH_TRANSFORM_AVX
+        #define CARTOTYPE_BATCH_TRANSFORM_AVX_TARGET
+        #include <immintrin.h>
+    #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #define CARTOTYPE_BATCH_TRANSFORM_NEON
+    #include <arm_neon.h>
+#endif
+
+namespace CartoType
+{
+
+/**
+Transforms arrays of points by a 2D affine transform or a projective transform, for use when drawing,
+where every point of every path is transformed.
+
+Points are interleaved x and y values. Results may be stored as floating-point numbers, or rounded to 64ths
+in the same way as CContour::AppendPointDouble, for direct use as outline points. The same array may be used for
+input and output.
+
+The work is done four points at a time using AVX if the processor supports it, otherwise two at a time using SSE2 on x86 and x64
+processors or NEON on 64-bit ARM processors. Each kernel uses the same operations in the same order as the scalar code,
+so the results are identical whichever kernel is used, unless the compiler fuses multiplications and additions in the scalar code.
+
+A perspective transform maps the point (x,y) to the point (x,y,0,1) in 3D and divides the result by its w coordinate,
+in the same way as TPerspectiveTransformFP::Transform(TPointFP&).
+*/
+class TBatchTransform
+    {
+    public:
+    /** The sets of instructions used to transform points. */
+    enum class TKernel
+        {
+        /** Ordinary C++ code, one point at a time. */
+        Scalar,
+        /** SSE2 instructions, two points at a time. */
+        Sse2,
+        /** AVX instructions, four points at a time. */
+        Avx,
+        /** NEON instructions, two points at a time. */
+        Neon
+        };
+
+    /** Create a batch transform from a 2D affine transform. */
+    explicit TBatchTransform(const TTransformFP& aTransform)
+        {
+        SetAffine(aTransform.A(),aTransform.B(),aTransform.C(),aTransform.D(),aTransform.Tx(),aTransform.Ty());
+        }
+
+    /**
+    Create a batch transform from a fixed-point 2D affine transform. The transform is done in floating point,
+    so results may differ from those of TTransform by the fixed-point rounding error.
+    */
+    explicit TBatchTransform(const TTransform& aTransform)
+        {
+        SetAffine(aTransform.A().FpValue(),aTransform.B().FpValue(),aTransform.C().FpValue(),
+                  aTransform.D().FpValue(),aTransform.Tx().FpValue(),aTransform.Ty().FpValue());
+        }
+
+    /**
+    Create a batch transform from a 3D transform, which is applied to the point (x,y,0,1), followed by division by w.
+    The coefficients are found by transforming basis vectors, so they do not depend on the layout of the matrix.
+    */
+    explicit TBatchTransform(const TTransform3FP& aTransform)
+        {
+        double x = 1, y = 0, z = 0, w = 0;
+        aTransform.Transform(x,y,z,w);
+        iM[0] = x; iM[3] = y; iM[6] = w;
+        x = 0; y = 1; z = 0; w = 0;
+        aTransform.Transform(x,y,z,w);
+        iM[1] = x; iM[4] = y; iM[7] = w;
+        x = 0; y = 0; z = 0; w = 1;
+        aTransform.Transform(x,y,z,w);
+        iM[2] = x; iM[5] = y; iM[8] = w;
+        iPerspective = iM[6] != 0 || iM[7] != 0 || iM[8] != 1;
+        iKernel = BestKernel();
+        }
+
+    /** Create a batch transform from a perspective transform. */
+    explicit TBatchTransform(const TPerspectiveTransformFP& aTransform):
+        TBatchTransform(aTransform.Transform())
+        {
+        }
+
+    /** Return true if the transform is projective rather than affine, and therefore needs a division for each point. */
+    bool Perspective() const { return iPerspective; }
+
+    /** Return true if a kernel can be used on this processor. */
+    static bool KernelAvailable(TKernel aKernel)
+        {
+        switch (aKernel)
+            {
+            case TKernel::Scalar:
+                return true;
+#ifdef CARTOTYPE_BATCH_TRANSFORM_SSE2
+            case TKernel::Sse2:
+                return true;
+#endif
+#ifdef CARTOTYPE_BATCH_TRANSFORM_AVX
+            case TKernel::Avx:
+    #if defined(__GNUC__) || defined(__clang__)
+                {
+                static const bool available = __builtin_cpu_supports("avx");
+                return available;
+                }
+    #else
+                return true;
+    #endif
+#endif
+#ifdef CARTOTYPE_BATCH_TRANSFORM_NEON
+            case TKernel::Neon:
+                return true;
+#endif
+            default:
+                return false;
+            }
+        }
+
+    /** Return the fastest kernel available on this processor. */
+    static TKernel BestKernel()
+        {
+        if (KernelAvailable(TKernel::Avx))
+            return TKernel::Avx;
+        if (KernelAvailable(TKernel::Sse2))
+            return TKernel::Sse2;
+        if (KernelAvailable(TKernel::Neon))
+            return TKernel::Neon;
+        return TKernel::Scalar;
+        }
+
+    /** Return the kernel used by this transform. */
+    TKernel Kernel() const { return iKernel; }
+
+    /** Select the kernel to be used, for testing or benchmarking. Return KErrorUnimplemented if it is not available on this processor. */
+    TResult SetKernel(TKernel aKernel)
+        {
+        if (!KernelAvailable(aKernel))
+            return KErrorUnimplemented;
+        iKernel = aKernel;
+        return KErrorNone;
+        }
+
+    /** Transform aPointCount points from aSource, storing them in aDest, which may be the same as aSource. */
+    void Transform(const double* aSource,double* aDest,size_t aPointCount) const
+        {
+        if (iPerspective)
+            Run<true>(aSource,aDest,aPointCount);
+        else
+            Run<false>(aSource,aDest,aPointCount);
+        }
+
+    /** Transform aPointCount points in place. */
+    void Transform(TPointFP* aPoint,size_t aPointCount) const
+        {
+        static_assert(sizeof(TPointFP) == 2 * sizeof(double),"TPointFP must be two doubles");
+        Transform(reinterpret_cast<const double*>(aPoint),reinterpret_cast<double*>(aPoint),aPointCount);
+        }
+
+    /**
+    Transform aPointCount points from aSource and store them in aDest as interleaved x and y values in 64ths,
+    rounded in the same way as CContour::AppendPointDouble.
+    */
+    void TransformTo64ths(const double* aSource,int32* aDest,size_t aPointCount) const
+        {
+        if (iPerspective)
+            Run<true>(aSource,aDest,aPointCount);
+        else
+            Run<false>(aSource,aDest,aPointCount);
+        }
+
+    /**
+    Transform aPointCount points from aSource and append them to aContour as points in 64ths of type aPointType.
+    The result is the same as calling CContour::AppendPointDouble for each transformed point.
+    */
+    void AppendTo64ths(CContour& aContour,const double* aSource,size_t aPointCount,TPointType aPointType = TPointType::OnCurve) const
+        {
+        const size_t KBatchSize = 256;
+        int32 coord[KBatchSize * 2];
+        size_t start = aContour.Points();
+        aContour.SetSize(start + aPointCount);
+        TOutlinePoint* point = aContour.Point() + start;
+        while (aPointCount)
+            {
+            size_t n = aPointCount < KBatchSize ? aPointCount : KBatchSize;
+            TransformTo64ths(aSource,coord,n);
+            for (size_t i = 0; i < n; i++)
+                point[i] = TOutlinePoint(coord[i * 2],coord[i * 2 + 1],aPointType);
+            aSource += n * 2;
+            point += n;
+            aPointCount -= n;
+            }
+        }
+
+    private:
+    void SetAffine(double aA,double aB,double aC,double aD,double aTx,double aTy)
+        {
+        iM[0] = aA; iM[1] = aC; iM[2] = aTx;
+        iM[3] = aB; iM[4] = aD; iM[5] = aTy;
+        iM[6] = 0; iM[7] = 0; iM[8] = 1;
+        iPerspective = false;
+        iKernel = BestKernel();
+        }
+
+    static void Store(double aX,double aY,double* aDest) { aDest[0] = aX; aDest[1] = aY; }
+    static void Store(double aX,double aY,int32* aDest)
+        {
+        aDest[0] = Arithmetic::Round(aX * 64.0);
+        aDest[1] = Arithmetic::Round(aY * 64.0);
+        }
+
+    template<bool KPerspective,class T> void Run(const double* aSource,T* aDest,size_t aPointCount) const
+        {
+        size_t done = 0;
+        switch (iKernel)
+            {
+#ifdef CARTOTYPE_BATCH_TRANSFORM_AVX
+            case TKernel::Avx: done = TransformAvx<KPerspective>(iM,aSource,aDest,aPointCount); break;
+#endif
+#ifdef CARTOTYPE_BATCH_TRANSFORM_SSE2
+            case TKernel::Sse2: done = TransformSse2<KPerspective>(iM,aSource,aDest,aPointCount); break;
+#endif
+#ifdef CARTOTYPE_BATCH_TRANSFORM_NEON
+            case TKernel::Neon: done = TransformNeon<KPerspective>(iM,aSource,aDest,aPointCount); break;
+#endif
+            default: break;
+            }
+        TransformScalar<KPerspective>(iM,aSource + done * 2,aDest + done * 2,aPointCount - done);
+        }
+
+    template<bool KPerspective,class T> static void TransformScalar(const double* aM,const double* aSource,T* aDest,size_t aPointCount)
+        {
+        for (size_t i = 0; i < aPointCount; i++)
+            {
+            double x = aSource[i * 2], y = aSource[i * 2 + 1];
+            double tx = aM[0] * x + aM[1] * y + aM[2];
+            double ty = aM[3] * x + aM[4] * y + aM[5];
+            if (KPerspective)
+                {
+                double w = aM[6] * x + aM[7] * y + aM[8];
+                tx /= w;
+                ty /= w;
+                }
+            Store(tx,ty,aDest + i * 2);
+            }
+        }
+
+#ifdef CARTOTYPE_BATCH_TRANSFORM_SSE2
+    /** Round values in 64ths as Arithmetic::Round does, by adding 0.5 with the sign of the value and truncating. */
+    static __m128i Round64thsSse2(__m128d aValue)
+        {
+        __m128d t = _mm_mul_pd(aValue,_mm_set1_pd(64.0));
+        __m128d half = _mm_or_pd(_mm_and_pd(t,_mm_set1_pd(-0.0)),_mm_set1_pd(0.5));
+        return _mm_cvttpd_epi32(_mm_add_pd(t,half));
+        }
+
+    static void StoreSse2(__m128d aX,__m128d aY,double* aDest)
+        {
+        _mm_storeu_pd(aDest,_mm_unpacklo_pd(aX,aY));
+        _mm_storeu_pd(aDest + 2,_mm_unpackhi_pd(aX,aY));
+        }
+
+    static void StoreSse2(__m128d aX,__m128d aY,int32* aDest)
+        {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(aDest),_mm_unpacklo_epi32(Round64thsSse2(aX),Round64thsSse2(aY)));
+        }
+
+    template<bool KPerspective,class T> static size_t TransformSse2(const double* aM,const double* aSource,T* aDest,size_t aPointCount)
+        {
+        const __m128d m0 = _mm_set1_pd(aM[0]), m1 = _mm_set1_pd(aM[1]), m2 = _mm_set1_pd(aM[2]);
+        const __m128d m3 = _mm_set1_pd(aM[3]), m4 = _mm_set1_pd(aM[4]), m5 = _mm_set1_pd(aM[5]);
+        const __m128d m6 = _mm_set1_pd(aM[6]), m7 = _mm_set1_pd(aM[7]), m8 = _mm_set1_pd(aM[8]);
+        size_t i = 0;
+        for (; i + 2 <= aPointCount; i += 2)
+            {
+            __m128d a = _mm_loadu_pd(aSource + i * 2);
+            __m128d b = _mm_loadu_pd(aSource + i * 2 + 2);
+            __m128d x = _mm_unpacklo_pd(a,b);
+            __m128d y = _mm_unpackhi_pd(a,b);
+            __m128d tx = _mm_add_pd(_mm_add_pd(_mm_mul_pd(m0,x),_mm_mul_pd(m1,y)),m2);
+            __m128d ty = _mm_add_pd(_mm_add_pd(_mm_mul_pd(m3,x),_mm_mul_pd(m4,y)),m5);
+            if (KPerspective)
+                {
+                __m128d w = _mm_add_pd(_mm_add_pd(_mm_mul_pd(m6,x),_mm_mul_pd(m7,y)),m8);
+                tx = _mm_div_pd(tx,w);
+                ty = _mm_div_pd(ty,w);
+                }
+            StoreSse2(tx,ty,aDest + i * 2);
+            }
+        return i;
+        }
+#endif
+
+#ifdef CARTOTYPE_BATCH_TRANSFORM_AVX
+    CARTOTYPE_BATCH_TRANSFORM_AVX_TARGET static void StoreAvx(__m256d aX,__m256d aY,double* aDest)
+        {
+        // aX and aY are (x0,x1,x2,x3) and (y0,y1,y2,y3); unpacking gives (x0,y0,x2,y2) and (x1,y1,x3,y3).
+        __m256d lo = _mm256_unpacklo_pd(aX,aY);
+        __m256d hi = _mm256_unpackhi_pd(aX,aY);
+        _mm256_storeu_pd(aDest,_mm256_permute2f128_pd(lo,hi,0x20));
+        _mm256_storeu_pd(aDest + 4,_mm256_permute2f128_pd(lo,hi,0x31));
+        }
+
+    CARTOTYPE_BATCH_TRANSFORM_AVX_TARGET static void StoreAvx(__m256d aX,__m256d aY,int32* aDest)
+        {
+        const __m256d scale = _mm256_set1_pd(64.0);
+        __m256d tx = _mm256_mul_pd(aX,scale);
+        __m256d ty = _mm256_mul_pd(aY,scale);
+        const __m256d sign = _mm256_set1_pd(-0.0), half = _mm256_set1_pd(0.5);
+        __m128i x = _mm256_cvttpd_epi32(_mm256_add_pd(tx,_mm256_or_pd(_mm256_and_pd(tx,sign),half)));
+        __m128i y = _mm256_cvttpd_epi32(_mm256_add_pd(ty,_mm256_or_pd(_mm256_and_pd(ty,sign),half)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(aDest),_mm_unpacklo_epi32(x,y));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(aDest + 4),_mm_unpackhi_epi32(x,y));
+        }
+
+    template<bool KPerspective,class T> CARTOTYPE_BATCH_TRANSFORM_AVX_TARGET
+    static size_t TransformAvx(const double* aM,const double* aSource,T* aDest,size_t aPointCount)
+        {
+        const __m256d m0 = _mm256_set1_pd(aM[0]), m1 = _mm256_set1_pd(aM[1]), m2 = _mm256_set1_pd(aM[2]);
+        const __m256d m3 = _mm256_set1_pd(aM[3]), m4 = _mm256_set1_pd(aM[4]), m5 = _mm256_set1_pd(aM[5]);
+        const __m256d m6 = _mm256_set1_pd(aM[6]), m7 = _mm256_set1_pd(aM[7]), m8 = _mm256_set1_pd(aM[8]);
+        size_t i = 0;
+        for (; i + 4 <= aPointCount; i += 4)
+            {
+            // Load (x0,y0,x1,y1) and (x2,y2,x3,y3), regroup the halves as (x0,y0,x2,y2) and (x1,y1,x3,y3), then separate x and y.
+            __m256d a = _mm256_loadu_pd(aSource + i * 2);
+            __m256d b = _mm256_loadu_pd(aSource + i * 2 + 4);
+            __m256d lo = _mm256_permute2f128_pd(a,b,0x20);
+            __m256d hi = _mm256_permute2f128_pd(a,b,0x31);
+            __m256d x = _mm256_unpacklo_pd(lo,hi);
+            __m256d y = _mm256_unpackhi_pd(lo,hi);
+            __m256d tx = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m0,x),_mm256_mul_pd(m1,y)),m2);
+            __m256d ty = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m3,x),_mm256_mul_pd(m4,y)),m5);
+            if (KPerspective)
+                {
+                __m256d w = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m6,x),_mm256_mul_pd(m7,y)),m8);
+                tx = _mm256_div_pd(tx,w);
+                ty = _mm256_div_pd(ty,w);
+                }
+            StoreAvx(tx,ty,aDest + i * 2);
+            }
+        return i;
+        }
+#endif
+
+#ifdef CARTOTYPE_BATCH_TRANSFORM_NEON
+    static void StoreNeon(float64x2_t aX,float64x2_t aY,double* aDest)
+        {
+        float64x2x2_t v;
+        v.val[0] = aX;
+        v.val[1] = aY;
+        vst2q_f64(aDest,v);
+        }
+
+    /** Round values in 64ths as Arithmetic::Round does, by adding 0.5 with the sign of the value and truncating. */
+    static int32x2_t Round64thsNeon(float64x2_t aValue)
+        {
+        float64x2_t t = vmulq_f64(aValue,vdupq_n_f64(64.0));
+        uint64x2_t half = vorrq_u64(vandq_u64(vreinterpretq_u64_f64(t),vdupq_n_u64(0x8000000000000000ULL)),
+                                    vreinterpretq_u64_f64(vdupq_n_f64(0.5)));
+        return vmovn_s64(vcvtq_s64_f64(vaddq_f64(t,vreinterpretq_f64_u64(half))));
+        }
+
+    static void StoreNeon(float64x2_t aX,float64x2_t aY,int32* aDest)
+        {
+        int32x2x2_t v;
+        v.val[0] = Round64thsNeon(aX);
+        v.val[1] = Round64thsNeon(aY);
+        vst2_s32(aDest,v);
+        }
+
+    template<bool KPerspective,class T> static size_t TransformNeon(const double* aM,const double* aSource,T* aDest,size_t aPointCount)
+        {
+        const float64x2_t m0 = vdupq_n_f64(aM[0]), m1 = vdupq_n_f64(aM[1]), m2 = vdupq_n_f64(aM[2]);
+        const float64x2_t m3 = vdupq_n_f64(aM[3]), m4 = vdupq_n_f64(aM[4]), m5 = vdupq_n_f64(aM[5]);
+        const float64x2_t m6 = vdupq_n_f64(aM[6]), m7 = vdupq_n_f64(aM[7]), m8 = vdupq_n_f64(aM[8]);
+        size_t i = 0;
+        for (; i + 2 <= aPointCount; i += 2)
+            {
+            float64x2x2_t p = vld2q_f64(aSource + i * 2);
+            float64x2_t x = p.val[0], y = p.val[1];
+            // Separate multiplies and adds, not fused ones, give the same results as the scalar code.
+            float64x2_t tx = vaddq_f64(vaddq_f64(vmulq_f64(m0,x),vmulq_f64(m1,y)),m2);
+            float64x2_t ty = vaddq_f64(vaddq_f64(vmulq_f64(m3,x),vmulq_f64(m4,y)),m5);
+            if (KPerspective)
+                {
+                float64x2_t w = vaddq_f64(vaddq_f64(vmulq_f64(m6,x),vmulq_f64(m7,y)),m8);
+                tx = vdivq_f64(tx,w);
+                ty = vdivq_f64(ty,w);
+                }
+            StoreNeon(tx,ty,aDest + i * 2);
+            }
+        return i;
+        }
+#endif
+
+    double iM[9];   // rows of the 3x3 matrix applied to (x,y,1): x' = iM[0]x + iM[1]y + iM[2], y' = iM[3]x + iM[4]y + iM[5], w = iM[6]x + iM[7]y + iM[8]
+    bool iPerspective = false;
+    TKernel iKernel = TKernel::Scalar;
+    };
+
+}
+
+#endif
@@ -0,0 +1,318 @@
+/*
+CARTOTYPE_BEST_ROUTE.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_BEST_ROUTE_H__
+#define CARTOTYPE_BEST_ROUTE_H__
+
+#include <cartotype_parallel.h>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+namespace CartoType
+{
+
+/** A square matrix of the costs of routes between waypoints. UINT32_MAX means that there is no route. */
+class CLegCostMatrix
+    {
+    public:
+    explicit CLegCostMatrix(size_t aSize = 0):
+        iSize(aSize),
+        iCost(aSize * aSize,UINT32_MAX)
+        {
+        }
+
+    /** Return the number of waypoints. */
+    size_t Size() const { return iSize; }
+    /** Return the cost of the route from waypoint aFrom to waypoint aTo. */
+    uint32 Cost(size_t aFrom,size_t aTo) const { return iCost[aFrom * iSize + aTo]; }
+    /** Set the cost of the route from waypoint aFrom to waypoint aTo. */
+    void SetCost(size_t aFrom,size_t aTo,uint32 aCost) { iCost[aFrom * iSize + aTo] = aCost; }
+    /** Return the costs of the routes from waypoint aFrom to all the waypoints. */
+    uint32* Row(size_t aFrom) { return iCost.data() + aFrom * iSize; }
+
+    /** Return the total cost of visiting the waypoints in the order aOrder. */
+    uint64 PathCost(const std::vector<size_t>& aOrder) const
+        {
+        uint64 cost = 0;
+        for (size_t i = 1; i < aOrder.size(); i++)
+            cost += Cost(aOrder[i - 1],aOrder[i]);
+        return cost;
+        }
+
+    private:
+    size_t iSize;
+    std::vector<uint32> iCost;
+    };
+
+/**
+A cache of leg costs, keyed by caller-defined waypoint identifiers, such as the ids of the route nodes nearest
+to the waypoints. The cache must be cleared when anything affecting route costs, such as the route profile, changes.
+*/
+class CLegCostCache
+    {
+    public:
+    /** Discard all costs. */
+    void Clear() { iCost.clear(); }
+    /** Return the number of costs stored. */
+    size_t Count() const { return iCost.size(); }
+
+    /** Find the cost of the route from aFrom to aTo. Return true if it is in the cache. */
+    bool Find(uint64 aFrom,uint64 aTo,uint32& aCost) const
+        {
+        auto p = iCost.find(TKey(aFrom,aTo));
+        if (p == iCost.end())
+            return false;
+        aCost = p->second;
+        return true;
+        }
+
+    /** Store the cost of the route from aFrom to aTo. */
+    void Insert(uint64 aFrom,uint64 aTo,uint32 aCost)
+        {
+        iCost[TKey(aFrom,aTo)] = aCost;
+        }
+
+    private:
+    using TKey = std::pair<uint64,uint64>;
+    class THash
+        {
+        public:
+        size_t operator()(const TKey& aKey) const
+            {
+            uint64 h = aKey.first * 0x9E3779B97F4A7C15ULL ^ (aKey.second + 0x632BE59BD9B4E019ULL + (aKey.first << 6));
+            return size_t(h ^ (h >> 29));
+            }
+        };
+
+    std::unordered_map<TKey,uint32,THash> iCost;
+    };
+
+/**
+A function to calculate the costs of the routes from the waypoint with index aFrom to all the waypoints,
+putting them in aCost[0...n - 1], where n is the number of waypoints, using UINT32_MAX if there is no route.
+It is normally implemented by a one-to-many search such as TDijkstra::CalculateRoutes, stopping when all the
+waypoints have been reached. It may be called from several threads at once, so each call must use its own search state.
+*/
+using TLegCostFunction = std::function<TResult(size_t aFrom,uint32* aCost)>;
+
+/**
+Calculate the matrix of route costs between the waypoints identified by aWaypointId, using one call to
+aFunction for each row. Rows are calculated in parallel if aThreadPool is non-null. If aCache is non-null,
+rows whose costs are all in the cache are taken from it, and new costs are added to it.
+*/
+inline TResult CalculateLegCostMatrix(CLegCostMatrix& aMatrix,const std::vector<uint64>& aWaypointId,TLegCostFunction aFunction,
+                                      CThreadPool* aThreadPool = nullptr,CLegCostCache* aCache = nullptr)
+    {
+    const size_t n = aWaypointId.size();
+    aMatrix = CLegCostMatrix(n);
+    std::vector<size_t> row_to_calculate;
+    for (size_t i = 0; i < n; i++)
+        {
+        bool cached = aCache != nullptr;
+        for (size_t j = 0; cached && j < n; j++)
+            {
+            uint32 cost = 0;
+            cached = aCache->Find(aWaypointId[i],aWaypointId[j],cost);
+            aMatrix.SetCost(i,j,cost);
+            }
+        if (!cached)
+            row_to_calculate.push_back(i);
+        }
+
+    std::vector<TResult> error(row_to_calculate.size());
+    auto calculate_row = [&](size_t aIndex)
+        {
+        size_t row = row_to_calculate[aIndex];
+        error[aIndex] = aFunction(row,aMatrix.Row(row));
+        };
+    if (aThreadPool)
+        aThreadPool->ParallelFor(row_to_calculate.size(),calculate_row);
+    else
+        {
+        for (size_t i = 0; i < row_to_calculate.size(); i++)
+            calculate_row(i);
+        }
+
+    for (size_t i = 0; i < row_to_calculate.size(); i++)
+        {
+        if (error[i])
+            return error[i];
+        if (aCache)
+            {
+            size_t row = row_to_calculate[i];
+            for (size_t j = 0; j < n; j++)
+                aCache->Insert(aWaypointId[row],aWaypointId[j],aMatrix.Cost(row,j));
+            }
+        }
+    return KErrorNone;
+    }
+
+/**
+Find a low-cost order in which to visit all the waypoints of aMatrix, putting the waypoint indexes in aOrder.
+If aStartFixed is true the first waypoint stays first, and if aEndFixed is true the last waypoint stays last.
+
+The order is created by the nearest-neighbour method, then improved by 2-opt and Or-opt moves until
+no move helps. Costs need not be symmetrical: 2-opt moves take account of the cost of reversing a section.
+Then aIterations times, the best order is perturbed by a random double-bridge move and improved again,
+keeping the result if it is better. Only the matrix is used, so no routes are calculated.
+*/
+inline void OptimizeWaypointOrder(std::vector<size_t>& aOrder,const CLegCostMatrix& aMatrix,bool aStartFixed,bool aEndFixed,size_t aIterations = 10)
+    {
+    const size_t n = aMatrix.Size();
+    aOrder.clear();
+    if (n == 0)
+        return;
+    const size_t first = aStartFixed ? 1 : 0;                       // the first movable position
+    const size_t last = aEndFixed ? n - 1 : n;                      // the end of the movable positions
+    auto cost = [&aMatrix](size_t aFrom,size_t aTo) { return int64(aMatrix.Cost(aFrom,aTo)); };
+
+    if (n == 1)
+        {
+        aOrder.push_back(0);
+        return;
+        }
+
+    // Create the order using the nearest-neighbour method. If the start is not fixed, try every start.
+    std::vector<size_t> order;
+    uint64 best_nn_cost = UINT64_MAX;
+    const size_t start_count = aStartFixed ? 1 : last;
+    for (size_t start = 0; start < start_count; start++)
+        {
+        std::vector<size_t> o(1,start);
+        std::vector<bool> used(n,false);
+        used[start] = true;
+        if (aEndFixed)
+            used[n - 1] = true;
+        while (o.size() < last)
+            {
+            size_t nearest = n;
+            for (size_t j = 0; j < n; j++)
+                if (!used[j] && (nearest == n || cost(o.back(),j) < cost(o.back(),nearest)))
+                    nearest = j;
+            o.push_back(nearest);
+            used[nearest] = true;
+            }
+        if (last < n)
+            o.push_back(n - 1);
+        uint64 c = aMatrix.PathCost(o);
+        if (c < best_nn_cost)
+            {
+            best_nn_cost = c;
+            order.swap(o);
+            }
+        }
+
+    // Improve an order by 2-opt and Or-opt moves until no move helps.
+    std::vector<int64> forward(n), backward(n); // prefix sums of the costs of the order and of the reversed legs
+    auto improve = [&](std::vector<size_t>& aCandidate)
+        {
+        bool improved = true;
+        while (improved)
+            {
+            improved = false;
+            forward[0] = backward[0] = 0;
+            for (size_t k = 1; k < n; k++)
+                {
+                forward[k] = forward[k - 1] + cost(aCandidate[k - 1],aCandidate[k]);
+                backward[k] = backward[k - 1] + cost(aCandidate[k],aCandidate[k - 1]);
+                }
+
+            // 2-opt: reverse the section i...j.
+            for (size_t i = first; i < last && !improved; i++)
+                for (size_t j = i + 1; j < last; j++)
+                    {
+                    int64 delta = (backward[j] - backward[i]) - (forward[j] - forward[i]);
+                    if (i > 0)
+                        delta += cost(aCandidate[i - 1],aCandidate[j]) - cost(aCandidate[i - 1],aCandidate[i]);
+                    if (j + 1 < n)
+                        delta += cost(aCandidate[i],aCandidate[j + 1]) - cost(aCandidate[j],aCandidate[j + 1]);
+                    if (delta < 0)
+                        {
+                        std::reverse(aCandidate.begin() + i,aCandidate.begin() + j + 1);
+                        improved = true;
+                        break;
+                        }
+                    }
+            if (improved)
+                continue;
+
+            // Or-opt: move the section i...i + length - 1 to a position after k or before i.
+            for (size_t length = 1; length <= 3 && !improved; length++)
+                for (size_t i = first; i + length <= last && !improved; i++)
+                    {
+                    size_t j = i + length - 1;
+                    int64 removal = 0;
+                    if (i > 0)
+                        removal -= cost(aCandidate[i - 1],aCandidate[i]);
+                    if (j + 1 < n)
+                        removal -= cost(aCandidate[j],aCandidate[j + 1]);
+                    if (i > 0 && j + 1 < n)
+                        removal += cost(aCandidate[i - 1],aCandidate[j + 1]);
+                    // Insert between positions k - 1 and k, where k is outside the section.
+                    for (size_t k = first; k <= last; k++)
+                        {
+                        if (k >= i && k <= j + 1)
+                            continue;
+                        int64 insertion = 0;
+                        if (k > 0)
+                            insertion += cost(aCandidate[k - 1],aCandidate[i]);
+                        if (k < n)
+                            insertion += cost(aCandidate[j],aCandidate[k]);
+                        if (k > 0 && k < n)
+                            insertion -= cost(aCandidate[k - 1],aCandidate[k]);
+                        if (removal + insertion < 0)
+                            {
+                            if (k < i)
+                                std::rotate(aCandidate.begin() + k,aCandidate.begin() + i,aCandidate.begin() + j + 1);
+                            else
+                                std::rotate(aCandidate.begin() + i,aCandidate.begin() + j + 1,aCandidate.begin() + k);
+                            improved = true;
+                            break;
+                            }
+                        }
+                    }
+            }
+        };
+
+    improve(order);
+    uint64 best_cost = aMatrix.PathCost(order);
+
+    // Iterated local search using double-bridge perturbations.
+    std::mt19937 random(1);
+    const size_t movable = last - first;
+    for (size_t iteration = 0; movable >= 8 && iteration < aIterations; iteration++)
+        {
+        std::vector<size_t> cut(3);
+        for (;;)
+            {
+            for (auto& c : cut)
+                c = first + 1 + random() % (movable - 1);
+            std::sort(cut.begin(),cut.end());
+            if (cut[0] < cut[1] && cut[1] < cut[2])
+                break;
+            }
+        std::vector<size_t> o(order.begin(),order.begin() + cut[0]);
+        o.insert(o.end(),order.begin() + cut[1],order.begin() + cut[2]);
+        o.insert(o.end(),order.begin() + cut[0],order.begin() + cut[1]);
+        o.insert(o.end(),order.begin() + cut[2],order.end());
+        improve(o);
+        uint64 c = aMatrix.PathCost(o);
+        if (c < best_cost)
+            {
+            best_cost = c;
+            order.swap(o);
+            }
+        }
+
+    aOrder.swap(order);
+    }
+
+}
+
+#endif
@@ -0,0 +1,847 @@
+/*
+CARTOTYPE_CCH.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_CCH_H__
+#define CARTOTYPE_CCH_H__
+
+#include <cartotype_base.h>
+#include <cartotype_parallel.h>
+#include <cartotype_stream.h>
+#include <algorithm>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+The metric-independent part of a customisable contraction hierarchy (CCH), after
+Dibbelt, Strasser and Wagner, 'Customizable Contraction Hierarchies' (2016).
+
+The nodes are ordered by nested dissection using their positions, and the graph is contracted
+in that order without reference to arc costs, creating a chordal graph of edges from each node to
+higher-ranked nodes. The topology depends only on the road network, so it can be created when
+the map is built and stored with it using Write and Read. Costs are applied afterwards, by creating
+a CCchMetric for each route profile; this is fast enough to be done whenever a profile changes.
+
+Nodes and arcs are identified by the caller's indexes, as passed to Build.
+*/
+class CCchTopology
+    {
+    public:
+    /** A value used for infinite costs and missing items. */
+    static constexpr uint32 KNone = UINT32_MAX;
+
+    /**
+    Create the topology from the positions of the nodes and a list of directed arcs, each a pair of
+    node indexes (start, end). Arcs in both directions between the same nodes share an edge of the hierarchy.
+    */
+    TResult Build(const std::vector<TPoint>& aNodePosition,const std::vector<std::pair<uint32,uint32>>& aArc)
+        {
+        const uint32 n = uint32(aNodePosition.size());
+        for (const auto& a : aArc)
+            if (a.first >= n || a.second >= n)
+                return KErrorInvalidArgument;
+
+        // Create an undirected adjacency list.
+        std::vector<uint32> adjacency_start(n + 1,0);
+        for (const auto& a : aArc)
+            if (a.first != a.second)
+                {
+                adjacency_start[a.first + 1]++;
+                adjacency_start[a.second + 1]++;
+                }
+        for (uint32 i = 0; i < n; i++)
+            adjacency_start[i + 1] += adjacency_start[i];
+        std::vector<uint32> adjacency(adjacency_start[n]);
+        std::vector<uint32> fill(adjacency_start.begin(),adjacency_start.end() - 1);
+        for (const auto& a : aArc)
+            if (a.first != a.second)
+                {
+                adjacency[fill[a.first]++] = a.second;
+                adjacency[fill[a.second]++] = a.first;
+                }
+
+        // Order the nodes by nested dissection.
+        std::vector<uint32> node(n);
+        for (uint32 i = 0; i < n; i++)
+            node[i] = i;
+        std::vector<uint32> order;
+        order.reserve(n);
+        std::vector<uint32> tag(n,0);
+        uint32 tag_value = 0;
+        Dissect(node.begin(),node.end(),aNodePosition,adjacency_start,adjacency,tag,tag_value,order);
+        iNodeAtRank = order;
+        iRank.assign(n,0);
+        for (uint32 r = 0; r < n; r++)
+            iRank[iNodeAtRank[r]] = r;
+
+        // Contract the nodes in rank order, adding the upward neighbours of each node to those of its lowest upward neighbour.
+        std::vector<std::vector<uint32>> up(n);
+        for (uint32 v = 0; v < n; v++)
+            for (uint32 k = adjacency_start[v]; k < adjacency_start[v + 1]; k++)
+                {
+                uint32 a = iRank[v], b = iRank[adjacency[k]];
+                if (a < b)
+                    up[a].push_back(b);
+                }
+        for (uint32 v = 0; v < n; v++)
+            {
+            auto& u = up[v];
+            std::sort(u.begin(),u.end());
+            u.erase(std::unique(u.begin(),u.end()),u.end());
+            if (u.size() > 1)
+                up[u[0]].insert(up[u[0]].end(),u.begin() + 1,u.end());
+            }
+
+        // Create the upward and downward edge lists and the levels.
+        iUpStart.assign(n + 1,0);
+        iUpHead.clear();
+        for (uint32 v = 0; v < n; v++)
+            {
+            iUpHead.insert(iUpHead.end(),up[v].begin(),up[v].end());
+            iUpStart[v + 1] = uint32(iUpHead.size());
+            std::vector<uint32>().swap(up[v]);
+            }
+        CreateDerivedData();
+
+        // Map the original arcs to edges.
+        iArcEdge.assign(aArc.size(),UINT32_MAX);
+        iArcUp.assign(aArc.size(),0);
+        for (uint32 i = 0; i < aArc.size(); i++)
+            {
+            uint32 a = iRank[aArc[i].first], b = iRank[aArc[i].second];
+            if (a == b)
+                continue;
+            iArcEdge[i] = FindEdge(std::min(a,b),std::max(a,b));
+            iArcUp[i] = a < b;
+            }
+        return KErrorNone;
+        }
+
+    /** Return the number of nodes. */
+    size_t NodeCount() const { return iRank.size(); }
+    /** Return the number of original arcs. */
+    size_t ArcCount() const { return iArcEdge.size(); }
+    /** Return the number of edges in the hierarchy, including shortcuts. */
+    size_t EdgeCount() const { return iUpHead.size(); }
+
+    /** Write the topology to a stream. */
+    TResult Write(MOutputStream& aOutputStream) const
+        {
+        TDataOutputStream output(aOutputStream);
+        TResult error = output.WriteUint32(KFileSignature);
+        if (!error)
+            error = output.WriteUint32(KFileVersion);
+        if (!error)
+            error = WriteArray(output,iNodeAtRank);
+        if (!error)
+            error = WriteArray(output,iUpStart);
+        if (!error)
+            error = WriteArray(output,iUpHead);
+        if (!error)
+            error = WriteArray(output,iArcEdge);
+        if (!error)
+            error = WriteArray(output,iArcUp);
+        return error;
+        }
+
+    /** Read a topology written by Write. */
+    TResult Read(MInputStream& aInputStream)
+        {
+        TDataInputStream input(aInputStream);
+        TResult error = 0;
+        uint32 signature = input.ReadUint32(error);
+        if (!error && signature != KFileSignature)
+            return KErrorUnknownDataFormat;
+        uint32 version = 0;
+        if (!error)
+            version = input.ReadUint32(error);
+        if (!error && version != KFileVersion)
+            return KErrorUnknownVersion;
+        if (!error)
+            error = ReadArray(input,iNodeAtRank);
+        if (!error)
+            error = ReadArray(input,iUpStart);
+        if (!error)
+            error = ReadArray(input,iUpHead);
+        if (!error)
+            error = ReadArray(input,iArcEdge);
+        if (!error)
+            error = ReadArray(input,iArcUp);
+        if (!error && !Valid())
+            error = KErrorCorrupt;
+        if (error)
+            {
+            *this = CCchTopology();
+            return error;
+            }
+        const uint32 n = uint32(iNodeAtRank.size());
+        iRank.assign(n,0);
+        for (uint32 r = 0; r < n; r++)
+            iRank[iNodeAtRank[r]] = r;
+        CreateDerivedData();
+        return KErrorNone;
+        }
+
+    private:
+    friend class CCchMetric;
+    friend class CCchQuery;
+
+    static constexpr uint32 KFileSignature = 0x43544348; // 'CTCH'
+    static constexpr uint32 KFileVersion = 1;
+    static constexpr size_t KMaxLeafNodes = 8;
+
+    using TIter = std::vector<uint32>::iterator;
+
+    // Append the nodes in [aBegin,aEnd) to aOrder by nested dissection: first the two halves, then the separator between them.
+    static void Dissect(TIter aBegin,TIter aEnd,const std::vector<TPoint>& aPosition,const std::vector<uint32>& aAdjacencyStart,
+                        const std::vector<uint32>& aAdjacency,std::vector<uint32>& aTag,uint32& aTagValue,std::vector<uint32>& aOrder)
+        {
+        size_t count = aEnd - aBegin;
+        if (count <= KMaxLeafNodes)
+            {
+            aOrder.insert(aOrder.end(),aBegin,aEnd);
+            return;
+            }
+
+        // Split at the median of the longer axis.
+        int32 min_x = INT32_MAX, min_y = INT32_MAX, max_x = INT32_MIN, max_y = INT32_MIN;
+        for (auto p = aBegin; p != aEnd; ++p)
+            {
+            const TPoint& q = aPosition[*p];
+            min_x = std::min(min_x,q.iX);
+            min_y = std::min(min_y,q.iY);
+            max_x = std::max(max_x,q.iX);
+            max_y = std::max(max_y,q.iY);
+            }
+        bool by_x = int64(max_x) - min_x >= int64(max_y) - min_y;
+        TIter mid = aBegin + count / 2;
+        std::nth_element(aBegin,mid,aEnd,[&aPosition,by_x](uint32 aA,uint32 aB)
+            {
+            return by_x ? aPosition[aA].iX < aPosition[aB].iX : aPosition[aA].iY < aPosition[aB].iY;
+            });
+
+        // The separator is the smaller of the sets of nodes in each half with neighbours in the other half.
+        uint32 first_tag = ++aTagValue;
+        uint32 second_tag = ++aTagValue;
+        for (auto p = aBegin; p != aEnd; ++p)
+            aTag[*p] = p < mid ? first_tag : second_tag;
+        auto on_boundary = [&](uint32 aNode,uint32 aOtherTag)
+            {
+            for (uint32 k = aAdjacencyStart[aNode]; k < aAdjacencyStart[aNode + 1]; k++)
+                if (aTag[aAdjacency[k]] == aOtherTag)
+                    return true;
+            return false;
+            };
+        size_t first_boundary = std::count_if(aBegin,mid,[&](uint32 aNode) { return on_boundary(aNode,second_tag); });
+        size_t second_boundary = std::count_if(mid,aEnd,[&](uint32 aNode) { return on_boundary(aNode,first_tag); });
+        std::vector<uint32> separator_nodes;
+        if (first_boundary <= second_boundary)
+            {
+            TIter separator = std::stable_partition(aBegin,mid,[&](uint32 aNode) { return !on_boundary(aNode,second_tag); });
+            separator_nodes.assign(separator,mid);
+            Dissect(aBegin,separator,aPosition,aAdjacencyStart,aAdjacency,aTag,aTagValue,aOrder);
+            Dissect(mid,aEnd,aPosition,aAdjacencyStart,aAdjacency,aTag,aTagValue,aOrder);
+            }
+        else
+            {
+            TIter separator = std::stable_partition(mid,aEnd,[&](uint32 aNode) { return !on_boundary(aNode,first_tag); });
+            separator_nodes.assign(separator,aEnd);
+            Dissect(aBegin,mid,aPosition,aAdjacencyStart,aAdjacency,aTag,aTagValue,aOrder);
+            Dissect(mid,separator,aPosition,aAdjacencyStart,aAdjacency,aTag,aTagValue,aOrder);
+            }
+        aOrder.insert(aOrder.end(),separator_nodes.begin(),separator_nodes.end());
+        }
+
+    /**
+    Check that the arrays read from a file are consistent, so that customisation and queries stay within them:
+    the rank order must be a permutation of the nodes, the upward edges of each rank must be sorted and lead to higher ranks,
+    and the graph must be chordal in the sense used by customisation: the upward neighbours of each rank, apart from the lowest,
+    must be upward neighbours of the lowest. By induction from the highest rank, that gives the edge (u,w) for every pair
+    of upward neighbours u < w of any rank.
+    */
+    bool Valid() const
+        {
+        const size_t n = iNodeAtRank.size();
+        if (n >= UINT32_MAX || iUpStart.size() != n + 1 || iUpStart[0] != 0 || iUpStart.back() != iUpHead.size() || iArcUp.size() != iArcEdge.size())
+            return false;
+        std::vector<uint8> seen(n,0);
+        for (auto node : iNodeAtRank)
+            {
+            if (node >= n || seen[node])
+                return false;
+            seen[node] = 1;
+            }
+        for (size_t v = 0; v < n; v++)
+            {
+            uint32 begin = iUpStart[v], end = iUpStart[v + 1];
+            if (begin > end)
+                return false;
+            for (uint32 e = begin; e < end; e++)
+                if (iUpHead[e] <= v || iUpHead[e] >= n || (e > begin && iUpHead[e] <= iUpHead[e - 1]))
+                    return false;
+            }
+        for (size_t v = 0; v < n; v++)
+            {
+            uint32 begin = iUpStart[v], end = iUpStart[v + 1];
+            if (end - begin < 2)
+                continue;
+            uint32 low = iUpHead[begin];
+            uint32 e = iUpStart[low], low_end = iUpStart[low + 1];
+            for (uint32 f = begin + 1; f < end; f++)
+                {
+                while (e < low_end && iUpHead[e] < iUpHead[f])
+                    e++;
+                if (e == low_end || iUpHead[e] != iUpHead[f])
+                    return false;
+                }
+            }
+        for (auto edge : iArcEdge)
+            if (edge != KNone && edge >= iUpHead.size())
+                return false;
+        return true;
+        }
+
+    // Create the downward edge lists and the levels from the upward edge lists.
+    void CreateDerivedData()
+        {
+        const uint32 n = uint32(iNodeAtRank.size());
+        iDownStart.assign(n + 1,0);
+        for (uint32 e = 0; e < iUpHead.size(); e++)
+            iDownStart[iUpHead[e] + 1]++;
+        for (uint32 i = 0; i < n; i++)
+            iDownStart[i + 1] += iDownStart[i];
+        iDownTail.resize(iUpHead.size());
+        iDownEdge.resize(iUpHead.size());
+        std::vector<uint32> fill(iDownStart.begin(),iDownStart.end() - 1);
+        std::vector<uint32> level(n,0);
+        uint32 max_level = 0;
+        for (uint32 v = 0; v < n; v++)
+            for (uint32 e = iUpStart[v]; e < iUpStart[v + 1]; e++)
+                {
+                uint32 u = iUpHead[e];
+                iDownTail[fill[u]] = v;
+                iDownEdge[fill[u]++] = e;
+                level[u] = std::max(level[u],level[v] + 1);
+                max_level = std::max(max_level,level[u]);
+                }
+        iLevelStart.assign(n ? max_level + 2 : 1,0);
+        for (uint32 v = 0; v < n; v++)
+            iLevelStart[level[v] + 1]++;
+        for (size_t i = 1; i < iLevelStart.size(); i++)
+            iLevelStart[i] += iLevelStart[i - 1];
+        iLevelNode.resize(n);
+        std::vector<uint32> level_fill(iLevelStart.begin(),iLevelStart.end() - 1);
+        for (uint32 v = 0; v < n; v++)
+            iLevelNode[level_fill[level[v]]++] = v;
+        }
+
+    // Return the edge from aLow to aHigh, which are ranks.
+    uint32 FindEdge(uint32 aLow,uint32 aHigh) const
+        {
+        auto begin = iUpHead.begin() + iUpStart[aLow];
+        auto end = iUpHead.begin() + iUpStart[aLow + 1];
+        auto p = std::lower_bound(begin,end,aHigh);
+        return (p != end && *p == aHigh) ? uint32(p - iUpHead.begin()) : KNone;
+        }
+
+    template<class T> static TResult WriteArray(TDataOutputStream& aOutput,const std::vector<T>& aArray)
+        {
+        TResult error = aOutput.WriteUint32(uint32(aArray.size()));
+        for (size_t i = 0; !error && i < aArray.size(); i++)
+            error = aOutput.WriteUint32(uint32(aArray[i]));
+        return error;
+        }
+
+    template<class T> static TResult ReadArray(TDataInputStream& aInput,std::vector<T>& aArray)
+        {
+        TResult error = 0;
+        uint32 size = aInput.ReadUint32(error);
+        aArray.clear();
+        // Reserve no more than a limited amount in advance, so that a corrupt size cannot cause a huge allocation.
+        const uint32 max_reserve = 1 << 20;
+        if (!error)
+            aArray.reserve(size < max_reserve ? size : max_reserve);
+        for (uint32 i = 0; !error && i < size; i++)
+            aArray.push_back(T(aInput.ReadUint32(error)));
+        return error;
+        }
+
+    std::vector<uint32> iRank;          // the rank of each node
+    std::vector<uint32> iNodeAtRank;    // the node at each rank
+    std::vector<uint32> iUpStart;       // the start of the upward edges of each rank in iUpHead
+    std::vector<uint32> iUpHead;        // the upper rank of each edge; sorted for each lower rank
+    std::vector<uint32> iDownStart;     // the start of the downward edges of each rank in iDownTail and iDownEdge
+    std::vector<uint32> iDownTail;      // the lower rank of each downward edge; sorted for each upper rank
+    std::vector<uint32> iDownEdge;      // the edge index of each downward edge
+    std::vector<uint32> iLevelStart;    // the start of each level in iLevelNode
+    std::vector<uint32> iLevelNode;     // ranks grouped by level: no rank has a lower neighbour in the same or a higher level
+    std::vector<uint32> iArcEdge;       // the edge for each original arc
+    std::vector<uint8> iArcUp;          // true if an original arc goes from the lower to the higher rank of its edge
+    };
+
+/**
+The costs of a customisable contraction hierarchy for a single route profile.
+Create it by calling Customize with the cost of every arc; call Customize again whenever the costs change.
+*/
+class CCchMetric
+    {
+    public:
+    /**
+    Set the costs of the arcs. aArcCost gives the cost of each arc passed to CCchTopology::Build,
+    or CCchTopology::KNone if the arc cannot be used. If aThreadPool is non-null, the work is
+    shared between its threads.
+    */
+    TResult Customize(const CCchTopology& aTopology,const std::vector<uint32>& aArcCost,CThreadPool* aThreadPool = nullptr)
+        {
+        if (aArcCost.size() != aTopology.ArcCount())
+            return KErrorInvalidArgument;
+        const uint32 KNone = CCchTopology::KNone;
+        const size_t edge_count = aTopology.EdgeCount();
+        iArcCost = aArcCost;
+        iUp.assign(edge_count,KNone);
+        iDown.assign(edge_count,KNone);
+        iUpArc.assign(edge_count,KNone);
+        iDownArc.assign(edge_count,KNone);
+        for (uint32 a = 0; a < aArcCost.size(); a++)
+            {
+            uint32 e = aTopology.iArcEdge[a];
+            if (e == KNone || aArcCost[a] == KNone)
+                continue;
+            std::vector<uint32>& cost = aTopology.iArcUp[a] ? iUp : iDown;
+            std::vector<uint32>& arc = aTopology.iArcUp[a] ? iUpArc : iDownArc;
+            if (aArcCost[a] < cost[e])
+                {
+                cost[e] = aArcCost[a];
+                arc[e] = a;
+                }
+            }
+
+        // Process the lower triangles of the edges of each level, using the final costs of the edges of lower levels.
+        // Each lower neighbour v of a node u gives a triangle (v,u,w) for every upward neighbour w of v above u;
+        // the edge (u,w) is found by a merge with the sorted upward neighbours of u.
+        const CCchTopology& t = aTopology;
+        auto customize_node = [this,&t](uint32 aNode)
+            {
+            const uint32 up_begin = t.iUpStart[aNode], up_end = t.iUpStart[aNode + 1];
+            for (uint32 p = t.iDownStart[aNode]; p < t.iDownStart[aNode + 1]; p++)
+                {
+                uint32 v = t.iDownTail[p];
+                uint32 e1 = t.iDownEdge[p]; // from v to aNode
+                uint32 e = up_begin;
+                for (uint32 e2 = e1 + 1; e2 < t.iUpStart[v + 1]; e2++) // from v to w
+                    {
+                    uint32 w = t.iUpHead[e2];
+                    while (e < up_end && t.iUpHead[e] < w)
+                        e++;
+                    assert(e < up_end && t.iUpHead[e] == w);
+                    uint32 up = Add(iDown[e1],iUp[e2]);
+                    if (up < iUp[e])
+                        {
+                        iUp[e] = up;
+                        iUpArc[e] = CCchTopology::KNone;
+                        }
+                    uint32 down = Add(iDown[e2],iUp[e1]);
+                    if (down < iDown[e])
+                        {
+                        iDown[e] = down;
+                        iDownArc[e] = CCchTopology::KNone;
+                        }
+                    }
+                }
+            };
+
+        const size_t KBlockSize = 64;
+        for (size_t level = 0; level + 1 < t.iLevelStart.size(); level++)
+            {
+            uint32 begin = t.iLevelStart[level], end = t.iLevelStart[level + 1];
+            if (aThreadPool && end - begin > KBlockSize)
+                {
+                aThreadPool->ParallelFor((end - begin + KBlockSize - 1) / KBlockSize,[&](size_t aBlock)
+                    {
+                    size_t block_end = std::min(size_t(end),begin + (aBlock + 1) * KBlockSize);
+                    for (size_t i = begin + aBlock * KBlockSize; i < block_end; i++)
+                        customize_node(t.iLevelNode[i]);
+                    });
+                }
+            else
+                {
+                for (uint32 i = begin; i < end; i++)
+                    customize_node(t.iLevelNode[i]);
+                }
+            }
+        return KErrorNone;
+        }
+
+    private:
+    friend class CCchQuery;
+
+    static uint32 Add(uint32 aA,uint32 aB)
+        {
+        uint64 c = uint64(aA) + aB;
+        return c >= CCchTopology::KNone ? CCchTopology::KNone : uint32(c);
+        }
+
+    std::vector<uint32> iUp;        // the cost from the lower to the upper rank of each edge
+    std::vector<uint32> iDown;      // the cost from the upper to the lower rank of each edge
+    std::vector<uint32> iUpArc;     // the original arc giving iUp, or KNone if it is a shortcut
+    std::vector<uint32> iDownArc;   // the original arc giving iDown, or KNone if it is a shortcut
+    std::vector<uint32> iArcCost;   // the cost of each original arc
+    };
+
+/** Parameters for CCchQuery::GetAlternativeRoutes. */
+class TCchAlternativeRouteParam
+    {
+    public:
+    /** The maximum number of alternative routes, not counting the best route. */
+    size_t iMaxAlternatives = 2;
+    /** The maximum extra cost of an alternative route as a fraction of the cost of the best route. */
+    double iMaxStretch = 0.25;
+    /** The maximum cost of the arcs an alternative may share with the routes already chosen, as a fraction of the cost of the best route. */
+    double iMaxShare = 0.8;
+    /**
+    The cost, as a fraction of the cost of the best route, of the section around the via node of an alternative
+    that must be a lowest-cost route. Testing it takes one extra query per via node examined, so it is disabled
+    by default; 0.25 is a typical value.
+    */
+    double iLocalOptimality = 0;
+    /** The maximum number of distinct via nodes examined. */
+    size_t iMaxCandidates = 32;
+    };
+
+/** A route found by CCchQuery::GetAlternativeRoutes. */
+class TCchRoute
+    {
+    public:
+    /** The cost of the route. */
+    uint32 iCost = 0;
+    /** The original arcs making up the route. */
+    std::vector<uint32> iArc;
+    };
+
+/**
+A route query on a customisable contraction hierarchy. The query searches upwards from the start and
+end nodes along their paths in the elimination tree, which needs no priority queue.
+Each thread must use its own CCchQuery; the topology and metric can be shared.
+*/
+class CCchQuery
+    {
+    public:
+    CCchQuery(const CCchTopology& aTopology,const CCchMetric& aMetric):
+        iTopology(aTopology),
+        iMetric(aMetric)
+        {
+        }
+
+    /**
+    Find the lowest-cost route from aStartNode to aEndNode, putting its cost in aCost and, if aArcPath
+    is non-null, the original arcs of the route in aArcPath. Return KErrorNoRoute if there is no route.
+    */
+    TResult Route(uint32 aStartNode,uint32 aEndNode,uint32& aCost,std::vector<uint32>* aArcPath = nullptr)
+        {
+        aCost = CCchTopology::KNone;
+        if (aArcPath)
+            aArcPath->clear();
+        if (aStartNode >= iTopology.NodeCount() || aEndNode >= iTopology.NodeCount())
+            return KErrorInvalidArgument;
+
+        uint32 s = iTopology.iRank[aStartNode];
+        uint32 t = iTopology.iRank[aEndNode];
+        uint32 middle = Search(s,t,iForward,iBackward,aCost);
+        if (middle != CCchTopology::KNone && aArcPath)
+            GetPath(s,t,middle,*aArcPath);
+        iForward.Clear();
+        iBackward.Clear();
+        return middle == CCchTopology::KNone ? KErrorNoRoute : KErrorNone;
+        }
+
+    /**
+    Find the lowest-cost route from aStartNode to aEndNode and up to aParam.iMaxAlternatives alternative routes,
+    putting them in aRouteArray, with the best route first.
+
+    The alternatives are found using the via-node method of Abraham, Delling, Goldberg and Werneck,
+    'Alternative routes in road networks' (2013), using the search spaces of the query for the best route:
+    every node reached by both the forward and backward searches gives a route through that node.
+    Routes are examined in order of increasing cost, and accepted if they are not too expensive (aParam.iMaxStretch),
+    do not share too much with the routes already chosen (aParam.iMaxShare), do not visit any node twice,
+    and pass the local optimality test (aParam.iLocalOptimality). Return KErrorNoRoute if there is no route.
+    */
+    TResult GetAlternativeRoutes(uint32 aStartNode,uint32 aEndNode,std::vector<TCchRoute>& aRouteArray,const TCchAlternativeRouteParam& aParam = TCchAlternativeRouteParam())
+        {
+        aRouteArray.clear();
+        if (aStartNode >= iTopology.NodeCount() || aEndNode >= iTopology.NodeCount())
+            return KErrorInvalidArgument;
+
+        uint32 s = iTopology.iRank[aStartNode];
+        uint32 t = iTopology.iRank[aEndNode];
+        uint32 best_cost = 0;
+        if (Search(s,t,iForward,iBackward,best_cost) == CCchTopology::KNone)
+            {
+            iForward.Clear();
+            iBackward.Clear();
+            return KErrorNoRoute;
+            }
+
+        // The via nodes are the nodes reached by both searches, in order of increasing cost.
+        std::vector<std::pair<uint32,uint32>> via_node;
+        for (uint32 v : iForward.iPath)
+            {
+            uint32 c = CCchMetric::Add(iForward.iCost[v],iBackward.iCost[v]);
+            if (c <= best_cost * (1 + aParam.iMaxStretch))
+                via_node.emplace_back(c,v);
+            }
+        std::sort(via_node.begin(),via_node.end());
+
+        // Examine the route through each via node, skipping via nodes on routes already examined, which give the same route.
+        if (iMark.size() != iTopology.NodeCount())
+            {
+            iMark.assign(iTopology.NodeCount(),0);
+            iMarkValue = 0;
+            }
+        if (++iMarkValue == 0)
+            {
+            std::fill(iMark.begin(),iMark.end(),0);
+            iMarkValue = 1;
+            }
+        std::vector<uint32> chosen_arc;
+        const double max_share = best_cost * aParam.iMaxShare;
+        size_t candidates = 0;
+        for (const auto& via : via_node)
+            {
+            if (aRouteArray.size() > aParam.iMaxAlternatives || candidates >= aParam.iMaxCandidates)
+                break;
+            if (iMark[via.second] == iMarkValue)
+                continue;
+            candidates++;
+            TCchRoute route;
+            route.iCost = via.first;
+            size_t via_index = GetPath(s,t,via.second,route.iArc);
+            for (uint32 arc : route.iArc)
+                iMark[ArcEnd(arc)] = iMarkValue;
+
+            if (!aRouteArray.empty())
+                {
+                double shared_cost = 0;
+                for (uint32 arc : route.iArc)
+                    if (std::binary_search(chosen_arc.begin(),chosen_arc.end(),arc))
+                        shared_cost += iMetric.iArcCost[arc];
+                if (shared_cost > max_share || !IsSimple(s,route))
+                    continue;
+                if (aParam.iLocalOptimality > 0 && !IsLocallyOptimal(route,via_index,best_cost * aParam.iLocalOptimality))
+                    continue;
+                }
+            chosen_arc.insert(chosen_arc.end(),route.iArc.begin(),route.iArc.end());
+            std::sort(chosen_arc.begin(),chosen_arc.end());
+            aRouteArray.push_back(std::move(route));
+            }
+
+        iForward.Clear();
+        iBackward.Clear();
+        return KErrorNone;
+        }
+
+    private:
+    // The costs and previous edges of the nodes reached by a search in one direction.
+    class TSearchSpace
+        {
+        public:
+        void Clear()
+            {
+            for (uint32 v : iPath)
+                {
+                iCost[v] = CCchTopology::KNone;
+                iEdge[v] = CCchTopology::KNone;
+                }
+            iPath.clear();
+            }
+
+        std::vector<uint32> iCost;
+        std::vector<uint32> iEdge;
+        std::vector<uint32> iPath; // the nodes on the path in the elimination tree
+        };
+
+    /*
+    Search upwards from aStart and aEnd and return the node where the lowest-cost route meets, or KNone if there is no route.
+    Routes costing more than aMaxCost are not found.
+    */
+    uint32 Search(uint32 aStart,uint32 aEnd,TSearchSpace& aForward,TSearchSpace& aBackward,uint32& aCost,uint32 aMaxCost = UINT32_MAX) const
+        {
+        Search(aStart,aForward,iMetric.iUp,aMaxCost);
+        Search(aEnd,aBackward,iMetric.iDown,aMaxCost);
+        uint32 middle = CCchTopology::KNone;
+        aCost = CCchTopology::KNone;
+        for (uint32 v : aForward.iPath)
+            {
+            uint32 c = CCchMetric::Add(aForward.iCost[v],aBackward.iCost[v]);
+            if (c < aCost)
+                {
+                aCost = c;
+                middle = v;
+                }
+            }
+        return middle;
+        }
+
+    // Search upwards from aStart along its path in the elimination tree, whose root is the highest-ranked node of its component.
+    void Search(uint32 aStart,TSearchSpace& aSearch,const std::vector<uint32>& aEdgeCost,uint32 aMaxCost) const
+        {
+        if (aSearch.iCost.size() != iTopology.NodeCount())
+            {
+            aSearch.iCost.assign(iTopology.NodeCount(),UINT32_MAX);
+            aSearch.iEdge.assign(iTopology.NodeCount(),UINT32_MAX);
+            }
+        aSearch.iPath.clear();
+        aSearch.iCost[aStart] = 0;
+        for (uint32 v = aStart; v != CCchTopology::KNone; )
+            {
+            aSearch.iPath.push_back(v);
+            uint32 begin = iTopology.iUpStart[v], end = iTopology.iUpStart[v + 1];
+            uint32 cost = aSearch.iCost[v];
+            if (cost <= aMaxCost && cost != CCchTopology::KNone)
+                {
+                for (uint32 e = begin; e < end; e++)
+                    {
+                    uint32 c = CCchMetric::Add(cost,aEdgeCost[e]);
+                    uint32 w = iTopology.iUpHead[e];
+                    if (c < aSearch.iCost[w])
+                        {
+                        aSearch.iCost[w] = c;
+                        aSearch.iEdge[w] = e;
+                        }
+                    }
+                }
+            v = begin < end ? iTopology.iUpHead[begin] : CCchTopology::KNone;
+            }
+        }
+
+    // Put the original arcs of the route from aStart to aEnd through aMiddle, found by the last search, in aArcPath, and return the index of the first arc after aMiddle.
+    size_t GetPath(uint32 aStart,uint32 aEnd,uint32 aMiddle,std::vector<uint32>& aArcPath) const
+        {
+        aArcPath.clear();
+        std::vector<std::pair<uint32,bool>> edge_path; // edges from the start to the end, and whether they are traversed upwards
+        for (uint32 v = aMiddle; v != aStart; v = Tail(iForward.iEdge[v]))
+            edge_path.emplace_back(iForward.iEdge[v],true);
+        std::reverse(edge_path.begin(),edge_path.end());
+        size_t forward_edges = edge_path.size();
+        for (uint32 v = aMiddle; v != aEnd; v = Tail(iBackward.iEdge[v]))
+            edge_path.emplace_back(iBackward.iEdge[v],false);
+        size_t middle_index = 0;
+        for (size_t i = 0; i < edge_path.size(); i++)
+            {
+            if (i == forward_edges)
+                middle_index = aArcPath.size();
+            Unpack(edge_path[i].first,edge_path[i].second,aArcPath);
+            }
+        if (forward_edges == edge_path.size())
+            middle_index = aArcPath.size();
+        return middle_index;
+        }
+
+    // Return the rank of the start or end of an original arc.
+    uint32 ArcStart(uint32 aArc) const
+        {
+        uint32 e = iTopology.iArcEdge[aArc];
+        return iTopology.iArcUp[aArc] ? Tail(e) : iTopology.iUpHead[e];
+        }
+    uint32 ArcEnd(uint32 aArc) const
+        {
+        uint32 e = iTopology.iArcEdge[aArc];
+        return iTopology.iArcUp[aArc] ? iTopology.iUpHead[e] : Tail(e);
+        }
+
+    // Return true if a route from aStart does not visit any node twice.
+    bool IsSimple(uint32 aStart,const TCchRoute& aRoute) const
+        {
+        std::vector<uint32> node(aRoute.iArc.size() + 1);
+        node[0] = aStart;
+        for (size_t i = 0; i < aRoute.iArc.size(); i++)
+            node[i + 1] = ArcEnd(aRoute.iArc[i]);
+        std::sort(node.begin(),node.end());
+        return std::adjacent_find(node.begin(),node.end()) == node.end();
+        }
+
+    // Return true if the section of a route extending aCost before and after the via node is a lowest-cost route.
+    bool IsLocallyOptimal(const TCchRoute& aRoute,size_t aViaIndex,double aCost)
+        {
+        size_t first = aViaIndex;
+        uint64 section_cost = 0;
+        while (first > 0 && section_cost < aCost)
+            section_cost += iMetric.iArcCost[aRoute.iArc[--first]];
+        size_t last = aViaIndex;
+        uint64 after_cost = 0;
+        while (last < aRoute.iArc.size() && after_cost < aCost)
+            after_cost += iMetric.iArcCost[aRoute.iArc[last++]];
+        if (first == last)
+            return true;
+        // Only routes cheaper than the section matter, so the search can ignore anything more expensive.
+        section_cost += after_cost;
+        uint32 max_cost = section_cost > UINT32_MAX ? UINT32_MAX : uint32(section_cost);
+        uint32 cost = 0;
+        Search(ArcStart(aRoute.iArc[first]),ArcEnd(aRoute.iArc[last - 1]),iTestForward,iTestBackward,cost,max_cost);
+        iTestForward.Clear();
+        iTestBackward.Clear();
+        return cost >= section_cost;
+        }
+
+    // Return the lower rank of an edge.
+    uint32 Tail(uint32 aEdge) const
+        {
+        const auto& start = iTopology.iUpStart;
+        return uint32(std::upper_bound(start.begin(),start.end(),aEdge) - start.begin()) - 1;
+        }
+
+    // Append the original arcs of an edge, traversed upwards or downwards, to aArcPath.
+    void Unpack(uint32 aEdge,bool aUp,std::vector<uint32>& aArcPath) const
+        {
+        uint32 arc = aUp ? iMetric.iUpArc[aEdge] : iMetric.iDownArc[aEdge];
+        if (arc != CCchTopology::KNone)
+            {
+            aArcPath.push_back(arc);
+            return;
+            }
+
+        // Find the lower triangle giving the cost of the edge.
+        const CCchTopology& t = iTopology;
+        uint32 low = Tail(aEdge), high = t.iUpHead[aEdge];
+        uint32 cost = aUp ? iMetric.iUp[aEdge] : iMetric.iDown[aEdge];
+        for (uint32 p = t.iDownStart[low]; p < t.iDownStart[low + 1]; p++)
+            {
+            uint32 v = t.iDownTail[p];
+            uint32 e1 = t.iDownEdge[p];
+            auto end = t.iUpHead.begin() + t.iUpStart[v + 1];
+            auto q = std::lower_bound(t.iUpHead.begin() + e1 + 1,end,high);
+            if (q == end || *q != high)
+                continue;
+            uint32 e2 = uint32(q - t.iUpHead.begin());
+            if (aUp && CCchMetric::Add(iMetric.iDown[e1],iMetric.iUp[e2]) == cost)
+                {
+                Unpack(e1,false,aArcPath);
+                Unpack(e2,true,aArcPath);
+                return;
+                }
+            if (!aUp && CCchMetric::Add(iMetric.iDown[e2],iMetric.iUp[e1]) == cost)
+                {
+                Unpack(e2,false,aArcPath);
+                Unpack(e1,true,aArcPath);
+                return;
+                }
+            }
+        assert(false);
+        }
+
+    const CCchTopology& iTopology;
+    const CCchMetric& iMetric;
+    TSearchSpace iForward;
+    TSearchSpace iBackward;
+    TSearchSpace iTestForward;      // used for the local optimality test of alternative routes
+    TSearchSpace iTestBackward;
+    std::vector<uint32> iMark;      // marks nodes on routes already examined by GetAlternativeRoutes
+    uint32 iMarkValue = 0;
+    };
+
+}
+
+#endif
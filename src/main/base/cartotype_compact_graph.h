@@ -0,0 +1,921 @@
+/*
+CARTOTYPE_COMPACT_GRAPH.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_COMPACT_GRAPH_H__
+#define CARTOTYPE_COMPACT_GRAPH_H__
+
+#include <cartotype_mapped_file.h>
+#include <cartotype_navigation.h>
+#include <cartotype_stream.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A routing graph stored in a compact form for A* routing.
+
+Nodes and arcs are identified by 32-bit indexes. The arcs leaving each node are stored contiguously
+(compressed sparse row form) in separate arrays of end nodes, KArc... flags and lengths, and there is a second
+index giving the arcs entering each node, for searches towards a destination.
+Node positions, which are used only for the A* heuristic, are delta-coded in blocks of KBlockSize nodes:
+each block stores its minimum coordinates and each node stores its offsets from them in the minimum
+number of bits, so positions take only a few bytes per node if nodes that are close in the graph have close indexes.
+
+All the data is held in a single block in the format used by Write and Read, so a graph is loaded
+by reading it into memory without any further processing, or is used in place in a memory-mapped file using Open.
+*/
+class CCompactRouterGraph
+    {
+    public:
+    /** The number of nodes in a block of delta-coded positions. */
+    static constexpr uint32 KBlockSize = 32;
+
+    /** An arc used to build the graph. */
+    class TArc
+        {
+        public:
+        TArc() { }
+        TArc(uint32 aStart,uint32 aEnd,uint32 aFlags,float aLength): iStart(aStart), iEnd(aEnd), iFlags(aFlags), iLength(aLength) { }
+
+        /** The index of the start node. */
+        uint32 iStart = 0;
+        /** The index of the end node. */
+        uint32 iEnd = 0;
+        /** Flags made from KArc... values. */
+        uint32 iFlags = 0;
+        /** The length in metres. */
+        float iLength = 0;
+        };
+
+    CCompactRouterGraph() { }
+    CCompactRouterGraph(const CCompactRouterGraph&) = delete;
+    CCompactRouterGraph& operator=(const CCompactRouterGraph&) = delete;
+    CCompactRouterGraph(CCompactRouterGraph&&) = default;
+    CCompactRouterGraph& operator=(CCompactRouterGraph&&) = default;
+
+    /**
+    Create the graph from node positions in map units and a list of arcs. aMetresPerUnit converts distances in
+    map units to metres for the A* heuristic; it must not exceed the true ground distance of a map unit anywhere
+    in the graph, or routes may not be optimal. Arcs are stored in order of start node, keeping the order of
+    arcs with the same start node; if aArcOrder is non-null it receives the index in aArc of each stored arc.
+    */
+    TResult Build(const std::vector<TPoint>& aNodePosition,const std::vector<TArc>& aArc,double aMetresPerUnit,std::vector<uint32>* aArcOrder = nullptr)
+        {
+        if (aNodePosition.size() >= UINT32_MAX || aArc.size() >= UINT32_MAX)
+            return KErrorInvalidArgument;
+        const uint32 n = uint32(aNodePosition.size());
+        const uint32 m = uint32(aArc.size());
+        for (const auto& a : aArc)
+            if (a.iStart >= n || a.iEnd >= n)
+                return KErrorInvalidArgument;
+
+        // Find the extent and bit widths of each block of positions.
+        const uint32 block_count = (n + KBlockSize - 1) / KBlockSize;
+        std::vector<TCoordBlock> block(block_count);
+        uint64 coord_words = 0;
+        for (uint32 b = 0; b < block_count; b++)
+            {
+            uint32 first = b * KBlockSize;
+            uint32 last = std::min(n,first + KBlockSize);
+            int32 min_x = aNodePosition[first].iX, max_x = min_x, min_y = aNodePosition[first].iY, max_y = min_y;
+            for (uint32 i = first + 1; i < last; i++)
+                {
+                min_x = std::min(min_x,aNodePosition[i].iX);
+                max_x = std::max(max_x,aNodePosition[i].iX);
+                min_y = std::min(min_y,aNodePosition[i].iY);
+                max_y = std::max(max_y,aNodePosition[i].iY);
+                }
+            TCoordBlock& cb = block[b];
+            cb.iX = min_x;
+            cb.iY = min_y;
+            cb.iWord = uint32(coord_words);
+            cb.iWidthX = BitWidth(uint32(int64(max_x) - min_x));
+            cb.iWidthY = BitWidth(uint32(int64(max_y) - min_y));
+            coord_words += (uint64(last - first) * (cb.iWidthX + cb.iWidthY) + 63) / 64;
+            }
+        if (coord_words >= UINT32_MAX)
+            return KErrorInvalidArgument;
+
+        THeader header = { };
+        header.iSignature = KFileSignature;
+        header.iVersion = KFileVersion;
+        header.iByteOrderMark = KByteOrderMark;
+        header.iNodeCount = n;
+        header.iArcCount = m;
+        header.iBlockCount = block_count;
+        header.iCoordWordCount = uint32(coord_words);
+        header.iMetresPerUnit = aMetresPerUnit;
+        TLayout layout(header);
+        std::vector<uint64> storage(layout.iEnd,0);
+        std::memcpy(storage.data(),&header,sizeof(header));
+        uint8* base = reinterpret_cast<uint8*>(storage.data());
+        uint32* first_arc = reinterpret_cast<uint32*>(base + layout.iFirstArc);
+        uint32* arc_end = reinterpret_cast<uint32*>(base + layout.iArcEnd);
+        uint32* arc_flags = reinterpret_cast<uint32*>(base + layout.iArcFlags);
+        float* arc_length = reinterpret_cast<float*>(base + layout.iArcLength);
+        uint32* first_in_arc = reinterpret_cast<uint32*>(base + layout.iFirstInArc);
+        uint32* in_arc = reinterpret_cast<uint32*>(base + layout.iInArc);
+        uint32* in_arc_start = reinterpret_cast<uint32*>(base + layout.iInArcStart);
+        TCoordBlock* coord_block = reinterpret_cast<TCoordBlock*>(base + layout.iCoordBlock);
+        uint64* coord_bits = reinterpret_cast<uint64*>(base + layout.iCoordBits);
+
+        // Sort the arcs by start node, and index them by end node, using counting sorts, which are stable.
+        for (const auto& a : aArc)
+            first_arc[a.iStart + 1]++;
+        for (uint32 i = 0; i < n; i++)
+            first_arc[i + 1] += first_arc[i];
+        std::vector<uint32> order(m);
+        std::vector<uint32> fill(first_arc,first_arc + n);
+        for (uint32 i = 0; i < m; i++)
+            order[fill[aArc[i].iStart]++] = i;
+        for (uint32 i = 0; i < m; i++)
+            {
+            const TArc& a = aArc[order[i]];
+            arc_end[i] = a.iEnd;
+            arc_flags[i] = a.iFlags;
+            arc_length[i] = a.iLength;
+            first_in_arc[a.iEnd + 1]++;
+            }
+        for (uint32 i = 0; i < n; i++)
+            first_in_arc[i + 1] += first_in_arc[i];
+        fill.assign(first_in_arc,first_in_arc + n);
+        for (uint32 i = 0; i < m; i++)
+            {
+            const TArc& a = aArc[order[i]];
+            uint32 index = fill[a.iEnd]++;
+            in_arc[index] = i;
+            in_arc_start[index] = a.iStart;
+            }
+
+        // Store the positions.
+        for (uint32 b = 0; b < block_count; b++)
+            {
+            coord_block[b] = block[b];
+            const TCoordBlock& cb = block[b];
+            const uint32 width = cb.iWidthX + cb.iWidthY;
+            if (!width)
+                continue;
+            uint32 first = b * KBlockSize;
+            uint32 last = std::min(n,first + KBlockSize);
+            for (uint32 i = first; i < last; i++)
+                {
+                uint64 value = uint64(uint32(int64(aNodePosition[i].iX) - cb.iX)) | uint64(uint32(int64(aNodePosition[i].iY) - cb.iY)) << cb.iWidthX;
+                uint64 bit = uint64(i - first) * width;
+                uint64* p = coord_bits + cb.iWord + bit / 64;
+                uint32 shift = uint32(bit % 64);
+                p[0] |= value << shift;
+                if (shift + width > 64)
+                    p[1] |= value >> (64 - shift);
+                }
+            }
+
+        *this = CCompactRouterGraph();
+        iStorage.swap(storage);
+        SetData(iStorage.data(),iStorage.size(),false);
+        if (aArcOrder)
+            aArcOrder->swap(order);
+        return KErrorNone;
+        }
+
+    /**
+    Use graph data written by Write at byte offset aOffset in a memory-mapped file, which must be a multiple of eight.
+    The data is accessed in place, so opening a graph takes constant time and memory, and pages of the file
+    are read only when a search reaches them. The graph keeps a reference to the file.
+
+    If aCheck is true the data is checked for consistency as it is by Read, which reads the whole file; otherwise
+    only the header and size are checked, so the file must come from a trusted source.
+    */
+    TResult Open(std::shared_ptr<const CMappedFile> aFile,size_t aOffset = 0,bool aCheck = false)
+        {
+        if (!aFile || aOffset % sizeof(uint64) || aOffset > aFile->Size())
+            return KErrorInvalidArgument;
+        const uint8* data = aFile->Data() + aOffset;
+        if (reinterpret_cast<uintptr_t>(data) % sizeof(uint64))
+            return KErrorInvalidArgument;
+        *this = CCompactRouterGraph();
+        TResult error = SetData(reinterpret_cast<const uint64*>(data),(aFile->Size() - aOffset) / sizeof(uint64),aCheck);
+        if (!error)
+            iMappedFile = aFile;
+        return error;
+        }
+
+    /** Map the file aFileName, which must contain graph data written by Write, and use it as the graph. */
+    TResult Open(const char* aFileName,bool aCheck = false)
+        {
+        TResult error = KErrorNone;
+        std::shared_ptr<const CMappedFile> file(CMappedFile::New(error,aFileName));
+        if (error)
+            return error;
+        return Open(file,0,aCheck);
+        }
+
+    /** Return the number of nodes. */
+    uint32 NodeCount() const { return iNodeCount; }
+    /** Return the number of arcs. */
+    uint32 ArcCount() const { return iArcCount; }
+    /** Return the index of the first arc leaving aNode. The arcs leaving aNode are FirstArc(aNode) ... EndArc(aNode) - 1. */
+    uint32 FirstArc(uint32 aNode) const { return iFirstArc[aNode]; }
+    /** Return the index after the last arc leaving aNode. */
+    uint32 EndArc(uint32 aNode) const { return iFirstArc[aNode + 1]; }
+    /** Return the end node of an arc. */
+    uint32 ArcEnd(uint32 aArc) const { return iArcEnd[aArc]; }
+    /** Return the KArc... flags of an arc. */
+    uint32 ArcFlags(uint32 aArc) const { return iArcFlags[aArc]; }
+    /** Return the length of an arc in metres. */
+    float ArcLength(uint32 aArc) const { return iArcLength[aArc]; }
+    /** Return the position of the first entry for aNode in the index of arcs entering nodes. The entries for aNode are FirstInArc(aNode) ... EndInArc(aNode) - 1. */
+    uint32 FirstInArc(uint32 aNode) const { return iFirstInArc[aNode]; }
+    /** Return the position after the last entry for aNode in the index of arcs entering nodes. */
+    uint32 EndInArc(uint32 aNode) const { return iFirstInArc[aNode + 1]; }
+    /** Return the arc referred to by an entry in the index of arcs entering nodes. */
+    uint32 InArc(uint32 aIndex) const { return iInArc[aIndex]; }
+    /** Return the start node of the arc referred to by an entry in the index of arcs entering nodes. */
+    uint32 InArcStart(uint32 aIndex) const { return iInArcStart[aIndex]; }
+    /** Return the number of metres in a map unit, as used by the A* heuristic. */
+    double MetresPerUnit() const { return iMetresPerUnit; }
+    /** Return the number of bytes used by the graph data. */
+    size_t MemoryUsed() const { return iWords * sizeof(uint64); }
+
+    /** Return the position of a node in map units. */
+    TPoint NodePosition(uint32 aNode) const
+        {
+        const TCoordBlock& b = iCoordBlock[aNode / KBlockSize];
+        const uint32 width = b.iWidthX + b.iWidthY;
+        if (!width)
+            return TPoint(b.iX,b.iY);
+        uint64 bit = uint64(aNode % KBlockSize) * width;
+        const uint64* p = iCoordBits + b.iWord + bit / 64;
+        uint32 shift = uint32(bit % 64);
+        uint64 value = p[0] >> shift;
+        if (shift + width > 64)
+            value |= p[1] << (64 - shift);
+        uint32 dx = uint32(value & ((uint64(1) << b.iWidthX) - 1));
+        uint32 dy = uint32((value >> b.iWidthX) & ((uint64(1) << b.iWidthY) - 1));
+        return TPoint(int32(int64(b.iX) + dx),int32(int64(b.iY) + dy));
+        }
+
+    /** Write the graph to a stream. The data is written in the byte order of the current processor. */
+    TResult Write(MOutputStream& aOutputStream) const
+        {
+        if (!iWords)
+            return KErrorGeneral;
+        return aOutputStream.Write(reinterpret_cast<const uint8*>(iData),iWords * sizeof(uint64));
+        }
+
+    /**
+    Read a graph written by Write. The data is checked for consistency so that corrupt data cannot cause
+    out-of-range memory accesses, and the sizes in the header are checked against the length of the stream,
+    or the data is read in chunks if the length is unknown, so that a corrupt or truncated stream cannot cause
+    a huge allocation; these errors are reported as KErrorCorrupt. Data written on a processor with a different
+    byte order is rejected with KErrorUnknownDataFormat.
+    */
+    TResult Read(MInputStream& aInputStream)
+        {
+        THeader header;
+        TResult error = ReadBytes(aInputStream,reinterpret_cast<uint8*>(&header),sizeof(header));
+        if (error)
+            return error;
+        error = CheckHeader(header);
+        if (error)
+            return error;
+        TLayout layout(header);
+        if (layout.iEnd > SIZE_MAX / sizeof(uint64))
+            return KErrorCorrupt;
+
+        // If the length of the stream is known, check that it holds all the data, then allocate the storage at once;
+        // otherwise read the data in chunks, growing the storage as it arrives.
+        const size_t min_chunk = 1 << 20;
+        std::vector<uint64> storage(KHeaderWords);
+        TResult length_error = 0;
+        int64 length = aInputStream.Length(length_error);
+        int64 position = length_error ? 0 : aInputStream.Position(length_error);
+        if (!length_error && length > 0)
+            {
+            if (length < position || uint64(length - position) < (layout.iEnd - KHeaderWords) * sizeof(uint64))
+                return KErrorCorrupt;
+            storage.reserve(size_t(layout.iEnd));
+            }
+        std::memcpy(storage.data(),&header,sizeof(header));
+        while (!error && storage.size() < layout.iEnd)
+            {
+            size_t size = storage.size();
+            size_t chunk = size_t(std::min(uint64(std::max(size,min_chunk)),layout.iEnd - size));
+            storage.resize(size + chunk);
+            error = ReadBytes(aInputStream,reinterpret_cast<uint8*>(storage.data() + size),chunk * sizeof(uint64));
+            if (error == KErrorEndOfData)
+                error = KErrorCorrupt;
+            }
+        if (!error)
+            error = SetData(storage.data(),storage.size(),true);
+        if (error)
+            {
+            *this = CCompactRouterGraph();
+            return error;
+            }
+        iStorage.swap(storage);
+        return KErrorNone;
+        }
+
+    private:
+    static constexpr uint32 KFileSignature = 0x47435443; // 'CTCG' in little-endian order
+    static constexpr uint32 KFileVersion = 1;
+    static constexpr uint32 KByteOrderMark = 0x01020304;
+    static constexpr size_t KHeaderWords = 6;
+
+    class THeader
+        {
+        public:
+        uint32 iSignature;
+        uint32 iVersion;
+        uint32 iByteOrderMark;
+        uint32 iNodeCount;
+        uint32 iArcCount;
+        uint32 iBlockCount;
+        uint32 iCoordWordCount;
+        uint32 iReserved;
+        double iMetresPerUnit;
+        uint64 iReserved2;
+        };
+    static_assert(sizeof(THeader) == KHeaderWords * sizeof(uint64),"THeader must fill the header words exactly");
+
+    class TCoordBlock
+        {
+        public:
+        int32 iX = 0;           // the minimum x coordinate
+        int32 iY = 0;           // the minimum y coordinate
+        uint32 iWord = 0;       // the start of the packed offsets in the array of 64-bit words
+        uint8 iWidthX = 0;      // the number of bits in each x offset
+        uint8 iWidthY = 0;      // the number of bits in each y offset
+        uint16 iReserved = 0;
+        };
+
+    // The byte offsets of the arrays, each aligned to eight bytes, and the total size in 64-bit words.
+    class TLayout
+        {
+        public:
+        TLayout(const THeader& aHeader)
+            {
+            const uint64 n = aHeader.iNodeCount;
+            const uint64 m = aHeader.iArcCount;
+            uint64 offset = KHeaderWords * sizeof(uint64);
+            auto add = [&offset](uint64 aBytes) -> uint64 { uint64 start = offset; offset += (aBytes + 7) & ~uint64(7); return start; };
+            iFirstArc = add((n + 1) * 4);
+            iArcEnd = add(m * 4);
+            iArcFlags = add(m * 4);
+            iArcLength = add(m * 4);
+            iFirstInArc = add((n + 1) * 4);
+            iInArc = add(m * 4);
+            iInArcStart = add(m * 4);
+            iCoordBlock = add(uint64(aHeader.iBlockCount) * sizeof(TCoordBlock));
+            iCoordBits = add((uint64(aHeader.iCoordWordCount) + 1) * 8); // one extra word so that reads never go past the end
+            iEnd = offset / 8;
+            }
+
+        uint64 iFirstArc, iArcEnd, iArcFlags, iArcLength, iFirstInArc, iInArc, iInArcStart, iCoordBlock, iCoordBits;
+        uint64 iEnd;
+        };
+
+    static uint8 BitWidth(uint32 aValue)
+        {
+        uint8 width = 0;
+        while (aValue)
+            {
+            width++;
+            aValue >>= 1;
+            }
+        return width;
+        }
+
+    static TResult CheckHeader(const THeader& aHeader)
+        {
+        if (aHeader.iSignature != KFileSignature || aHeader.iByteOrderMark != KByteOrderMark)
+            return KErrorUnknownDataFormat;
+        if (aHeader.iVersion != KFileVersion)
+            return KErrorUnknownVersion;
+        // Positions take at most 64 bits per node, so there cannot be more coordinate words than nodes.
+        if (aHeader.iNodeCount == UINT32_MAX || aHeader.iArcCount == UINT32_MAX ||
+            aHeader.iBlockCount != (uint64(aHeader.iNodeCount) + KBlockSize - 1) / KBlockSize ||
+            aHeader.iCoordWordCount > aHeader.iNodeCount)
+            return KErrorCorrupt;
+        return KErrorNone;
+        }
+
+    static TResult ReadBytes(MInputStream& aInputStream,uint8* aBuffer,size_t aBytes)
+        {
+        while (aBytes)
+            {
+            const uint8* p = nullptr;
+            size_t length = 0;
+            TResult error = aInputStream.Read(p,length);
+            if (error)
+                return error;
+            if (!length)
+                return KErrorEndOfData;
+            // The stream may return more than is needed, so go back to the end of the data used.
+            if (length > aBytes)
+                {
+                error = 0;
+                int64 position = aInputStream.Position(error);
+                if (!error)
+                    error = aInputStream.Seek(position - int64(length - aBytes));
+                if (error)
+                    return error;
+                length = aBytes;
+                }
+            std::memcpy(aBuffer,p,length);
+            aBuffer += length;
+            aBytes -= length;
+            }
+        return KErrorNone;
+        }
+
+    /**
+    Use aWords words of graph data at aData, which must stay valid as long as the graph uses it.
+    If aCheck is true, check that the data is consistent.
+    */
+    TResult SetData(const uint64* aData,size_t aWords,bool aCheck)
+        {
+        if (aWords < KHeaderWords)
+            return KErrorCorrupt;
+        THeader header;
+        std::memcpy(&header,aData,sizeof(header));
+        TResult error = CheckHeader(header);
+        if (error)
+            return error;
+        TLayout layout(header);
+        if (aWords < layout.iEnd)
+            return KErrorCorrupt;
+
+        const uint8* base = reinterpret_cast<const uint8*>(aData);
+        const uint32 n = header.iNodeCount;
+        const uint32 m = header.iArcCount;
+        const uint32* first_arc = reinterpret_cast<const uint32*>(base + layout.iFirstArc);
+        const uint32* arc_end = reinterpret_cast<const uint32*>(base + layout.iArcEnd);
+        const uint32* first_in_arc = reinterpret_cast<const uint32*>(base + layout.iFirstInArc);
+        const uint32* in_arc = reinterpret_cast<const uint32*>(base + layout.iInArc);
+        const uint32* in_arc_start = reinterpret_cast<const uint32*>(base + layout.iInArcStart);
+        const TCoordBlock* coord_block = reinterpret_cast<const TCoordBlock*>(base + layout.iCoordBlock);
+        if (aCheck)
+            {
+            if (first_arc[0] != 0 || first_arc[n] != m || first_in_arc[0] != 0 || first_in_arc[n] != m)
+                return KErrorCorrupt;
+            for (uint32 i = 0; i < n; i++)
+                if (first_arc[i] > first_arc[i + 1] || first_in_arc[i] > first_in_arc[i + 1])
+                    return KErrorCorrupt;
+            for (uint32 i = 0; i < m; i++)
+                if (arc_end[i] >= n || in_arc[i] >= m || in_arc_start[i] >= n)
+                    return KErrorCorrupt;
+            for (uint32 b = 0; b < header.iBlockCount; b++)
+                {
+                const TCoordBlock& cb = coord_block[b];
+                uint32 count = n - b * KBlockSize;
+                if (count > KBlockSize)
+                    count = KBlockSize;
+                if (cb.iWidthX > 32 || cb.iWidthY > 32 ||
+                    uint64(cb.iWord) * 64 + uint64(count) * (cb.iWidthX + cb.iWidthY) > uint64(header.iCoordWordCount) * 64)
+                    return KErrorCorrupt;
+                }
+            }
+
+        iData = aData;
+        iWords = size_t(layout.iEnd);
+        iNodeCount = n;
+        iArcCount = m;
+        iMetresPerUnit = header.iMetresPerUnit;
+        iFirstArc = first_arc;
+        iArcEnd = arc_end;
+        iArcFlags = reinterpret_cast<const uint32*>(base + layout.iArcFlags);
+        iArcLength = reinterpret_cast<const float*>(base + layout.iArcLength);
+        iFirstInArc = first_in_arc;
+        iInArc = in_arc;
+        iInArcStart = in_arc_start;
+        iCoordBlock = coord_block;
+        iCoordBits = reinterpret_cast<const uint64*>(base + layout.iCoordBits);
+        return KErrorNone;
+        }
+
+    std::vector<uint64> iStorage;           // the graph data, if owned by this object
+    std::shared_ptr<const CMappedFile> iMappedFile; // the file containing the graph data, if it is mapped
+    const uint64* iData = nullptr;
+    size_t iWords = 0;
+    uint32 iNodeCount = 0;
+    uint32 iArcCount = 0;
+    double iMetresPerUnit = 0;
+    const uint32* iFirstArc = nullptr;      // the first arc leaving each node, and a final entry equal to the number of arcs
+    const uint32* iArcEnd = nullptr;        // the end node of each arc
+    const uint32* iArcFlags = nullptr;      // the KArc... flags of each arc
+    const float* iArcLength = nullptr;      // the length of each arc in metres
+    const uint32* iFirstInArc = nullptr;    // the first entry in iInArc and iInArcStart for each node
+    const uint32* iInArc = nullptr;         // the arcs entering each node
+    const uint32* iInArcStart = nullptr;    // the start node of each arc in iInArc
+    const TCoordBlock* iCoordBlock = nullptr;
+    const uint64* iCoordBits = nullptr;
+    };
+
+/**
+Arc costs for a route profile, for use with a CCompactRouterGraph.
+Costs are travel times in milliseconds, or, if the profile's iShortest flag is set, lengths in centimetres.
+Turn times and gradients are not used.
+*/
+class TCompactArcCost
+    {
+    public:
+    explicit TCompactArcCost(const TRouteProfile& aProfile)
+        {
+        iVehicleType = aProfile.iVehicleType & KArcAccessMask;
+        iShortest = aProfile.iShortest;
+        double toll_factor = 1.0 - std::min(std::max(aProfile.iTollPenalty,0.0),1.0);
+        double max_speed = 0;
+        for (uint32 i = 0; i < KArcRoadTypeCount; i++)
+            {
+            iAllowed[i] = iVehicleType & ~aProfile.iRestrictionOverride[i];
+            double speed = aProfile.iShortest ? 36.0 : aProfile.iSpeed[i] + aProfile.iBonus[i];
+            if (speed > 0)
+                {
+                // 36 km/h is 10 metres per second, so at that speed there are 100 milliseconds and 100 centimetres in a metre.
+                iCostPerMetre[i] = 3600.0 / speed;
+                iTollCostPerMetre[i] = toll_factor > 0 ? 3600.0 / (speed * toll_factor) : -1;
+                max_speed = std::max(max_speed,speed);
+                }
+            else
+                iCostPerMetre[i] = iTollCostPerMetre[i] = -1;
+            double travel_speed = aProfile.iSpeed[i] > 0 ? aProfile.iSpeed[i] : aProfile.iSpeed[i] + aProfile.iBonus[i];
+            iSecondsPerMetre[i] = travel_speed > 0 ? 3.6 / travel_speed : 0;
+            }
+        iMinCostPerMetre = max_speed > 0 ? 3600.0 / max_speed : 0;
+        }
+
+    /** Return the cost of an arc with flags aFlags and length aLength in metres, or UINT32_MAX if it cannot be used. */
+    uint32 Cost(uint32 aFlags,float aLength) const
+        {
+        uint32 road_type = aFlags & KArcRoadTypeMask;
+        if (aFlags & iAllowed[road_type])
+            return UINT32_MAX;
+        double cost_per_metre = (aFlags & KArcTollFlag) ? iTollCostPerMetre[road_type] : iCostPerMetre[road_type];
+        if (cost_per_metre < 0)
+            return UINT32_MAX;
+        // Round up, so that the heuristic, which rounds down, never overestimates.
+        double cost = std::ceil(aLength * cost_per_metre);
+        return cost < UINT32_MAX ? uint32(cost) : UINT32_MAX - 1;
+        }
+
+    /** Return the lowest cost of a metre on any road, used to estimate the remaining cost of a route from the straight-line distance. */
+    double MinCostPerMetre() const { return iMinCostPerMetre; }
+
+    /** Return true if costs are lengths rather than times. */
+    bool Shortest() const { return iShortest; }
+
+    /** Return the estimated time in seconds taken to traverse an arc, using the profile's speeds, without the bonuses used to choose the route. */
+    double Time(uint32 aFlags,float aLength) const { return aLength * iSecondsPerMetre[aFlags & KArcRoadTypeMask]; }
+
+    private:
+    uint32 iVehicleType;
+    bool iShortest;
+    std::array<uint32,KArcRoadTypeCount> iAllowed;  // the restriction flags which prevent access, for each road type
+    std::array<double,KArcRoadTypeCount> iCostPerMetre;
+    std::array<double,KArcRoadTypeCount> iTollCostPerMetre;
+    std::array<double,KArcRoadTypeCount> iSecondsPerMetre;
+    double iMinCostPerMetre;
+    };
+
+/** A lower bound on route costs for CCompactRouter::Route that adds nothing to the straight-line heuristic. */
+class TCompactNoCostBound
+    {
+    public:
+    uint32 LowerBound(uint32 /*aNode*/,uint32 /*aTarget*/) const { return 0; }
+    bool ValidFor(uint32 /*aNodeCount*/) const { return true; }
+    };
+
+/**
+The state of a search of a CCompactRouterGraph, used by CCompactRouter. It takes 16 bytes for each node of the graph.
+
+The state of each node is valid only if its generation number matches that of the current search, so starting a new
+search takes constant time however many nodes the last one reached. A search state may be used by only one thread
+at a time; searches running at the same time use separate states, normally leased from a CCompactSearchStatePool.
+*/
+class CCompactSearchState
+    {
+    public:
+    explicit CCompactSearchState(uint32 aNodeCount):
+        iNode(aNodeCount)
+        {
+        }
+
+    /** Return the number of nodes in the graph for which the state was created. */
+    uint32 NodeCount() const { return uint32(iNode.size()); }
+    /** Return the number of nodes settled by the last search. */
+    size_t SettledNodeCount() const { return iSettledNodeCount; }
+
+    private:
+    friend class CCompactRouter;
+
+    class TNodeState
+        {
+        public:
+        uint32 iCost = 0;
+        uint32 iHeuristic = 0;
+        uint32 iPrevArc = 0;
+        uint32 iGeneration = 0;
+        };
+
+    using TEntry = std::pair<uint64,uint32>;
+
+    // Start a new search, invalidating the state of all nodes.
+    void NewSearch()
+        {
+        if (++iGeneration == 0)
+            {
+            for (auto& n : iNode)
+                n.iGeneration = 0;
+            iGeneration = 1;
+            }
+        iOpen.clear();
+        iSettledNodeCount = 0;
+        }
+
+    // Return the state of a node, which is valid only if Reached returns true.
+    TNodeState& Node(uint32 aNode) { return iNode[aNode]; }
+    bool Reached(uint32 aNode) const { return iNode[aNode].iGeneration == iGeneration; }
+    uint32 Cost(uint32 aNode) const { return Reached(aNode) ? iNode[aNode].iCost : UINT32_MAX; }
+
+    std::vector<TNodeState> iNode;
+    uint32 iGeneration = 0;
+    std::vector<TEntry> iOpen;      // the open set: a heap of (estimated total cost, node), allowing duplicates
+    size_t iSettledNodeCount = 0;
+    };
+
+/**
+A thread-safe pool of search states for a graph. States are created when needed and kept for reuse,
+so the number of states is the greatest number of searches that have run at the same time.
+*/
+class CCompactSearchStatePool
+    {
+    public:
+    explicit CCompactSearchStatePool(uint32 aNodeCount):
+        iNodeCount(aNodeCount)
+        {
+        }
+
+    /** A search state leased from the pool, which is returned to the pool when the lease is destroyed. */
+    class TLease
+        {
+        public:
+        TLease(TLease&& aOther):
+            iPool(aOther.iPool),
+            iState(std::move(aOther.iState))
+            {
+            }
+        ~TLease()
+            {
+            if (iState)
+                iPool.Release(std::move(iState));
+            }
+        TLease(const TLease&) = delete;
+        TLease& operator=(const TLease&) = delete;
+
+        CCompactSearchState& operator*() const { return *iState; }
+        CCompactSearchState* operator->() const { return iState.get(); }
+
+        private:
+        friend class CCompactSearchStatePool;
+        TLease(CCompactSearchStatePool& aPool,std::unique_ptr<CCompactSearchState> aState):
+            iPool(aPool),
+            iState(std::move(aState))
+            {
+            }
+
+        CCompactSearchStatePool& iPool;
+        std::unique_ptr<CCompactSearchState> iState;
+        };
+
+    /** Lease a search state, creating one if none is free. */
+    TLease Acquire()
+        {
+        std::unique_ptr<CCompactSearchState> state;
+            {
+            std::lock_guard<std::mutex> lock(iMutex);
+            if (!iFree.empty())
+                {
+                state = std::move(iFree.back());
+                iFree.pop_back();
+                }
+            else
+                iStateCount++;
+            }
+        if (!state)
+            state.reset(new CCompactSearchState(iNodeCount));
+        return TLease(*this,std::move(state));
+        }
+
+    /** Return the number of states created. */
+    size_t StateCount() const
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        return iStateCount;
+        }
+
+    /** Discard the states that are not in use. */
+    void Clear()
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        iStateCount -= iFree.size();
+        iFree.clear();
+        }
+
+    private:
+    void Release(std::unique_ptr<CCompactSearchState> aState)
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        iFree.push_back(std::move(aState));
+        }
+
+    uint32 iNodeCount;
+    mutable std::mutex iMutex;
+    std::vector<std::unique_ptr<CCompactSearchState>> iFree;
+    size_t iStateCount = 0;
+    };
+
+/**
+An A* router using a CCompactRouterGraph.
+
+The graph is never changed by searching, and the state of each search is kept separately, in a
+CCompactSearchState leased from the router's pool, so any number of threads can find routes at the same time
+using one router and one copy of the graph.
+*/
+class CCompactRouter
+    {
+    public:
+    explicit CCompactRouter(const CCompactRouterGraph& aGraph):
+        iGraph(aGraph),
+        iPool(aGraph.NodeCount())
+        {
+        }
+
+    /**
+    Find the lowest-cost route from aStart to aEnd using the costs in aArcCost, putting the cost in aCost,
+    and, if aArcPath is non-null, the arcs of the route in aArcPath. Return KErrorNoRoute if there is no route.
+    If aSettledNodeCount is non-null it receives the number of nodes settled by the search.
+    This function is thread-safe.
+    */
+    TResult Route(uint32 aStart,uint32 aEnd,const TCompactArcCost& aArcCost,uint32& aCost,std::vector<uint32>* aArcPath = nullptr,size_t* aSettledNodeCount = nullptr)
+        {
+        return Route(aStart,aEnd,aArcCost,TCompactNoCostBound(),aCost,aArcPath,aSettledNodeCount);
+        }
+
+    /**
+    Find a route as above, using aBound to strengthen the heuristic. aBound.LowerBound(aNode,aEnd) must return
+    a lower bound for the cost of a route from aNode to aEnd using aArcCost, such as one made by CCompactLandmarkCosts.
+    The heuristic is the greater of that bound and the bound calculated from the straight-line distance.
+    aBound.ValidFor(aNodeCount) must return false if the bound cannot be used for a graph of aNodeCount nodes,
+    in which case KErrorInvalidArgument is returned.
+    */
+    template<class TBound> TResult Route(uint32 aStart,uint32 aEnd,const TCompactArcCost& aArcCost,const TBound& aBound,uint32& aCost,
+                                         std::vector<uint32>* aArcPath = nullptr,size_t* aSettledNodeCount = nullptr)
+        {
+        CCompactSearchStatePool::TLease state = iPool.Acquire();
+        TResult error = Route(*state,aStart,aEnd,aArcCost,aBound,aCost,aArcPath);
+        if (aSettledNodeCount)
+            *aSettledNodeCount = state->SettledNodeCount();
+        return error;
+        }
+
+    /** Find a route as above using the search state aState, which must have been created for the router's graph. */
+    template<class TBound> TResult Route(CCompactSearchState& aState,uint32 aStart,uint32 aEnd,const TCompactArcCost& aArcCost,const TBound& aBound,
+                                         uint32& aCost,std::vector<uint32>* aArcPath = nullptr) const
+        {
+        auto arc_cost = [&](uint32 aArc,uint32 /*aCostSoFar*/) { return aArcCost.Cost(iGraph.ArcFlags(aArc),iGraph.ArcLength(aArc)); };
+        return RouteWithCostFunction(aState,aStart,aEnd,arc_cost,aArcCost.MinCostPerMetre(),aBound,aCost,aArcPath);
+        }
+
+    /**
+    Find a route using the search state aState and a cost function, which is called as aCostFunction(aArc,aCostSoFar) and returns
+    the cost of entering aArc when the cost of the route to its start is aCostSoFar, or UINT32_MAX if the arc cannot be used.
+    This allows costs that depend on the time of day, as long as entering an arc later never means leaving it earlier.
+    aMinCostPerMetre must be no greater than the cost of a metre of any arc at any time, and aBound must be a lower bound as above.
+    Return KErrorOverflow if the cost of the route does not fit in 32 bits.
+    */
+    template<class TCostFunction,class TBound> TResult RouteWithCostFunction(CCompactSearchState& aState,uint32 aStart,uint32 aEnd,const TCostFunction& aCostFunction,
+                                                                            double aMinCostPerMetre,const TBound& aBound,
+                                                                            uint32& aCost,std::vector<uint32>* aArcPath = nullptr) const
+        {
+        if (aStart >= iGraph.NodeCount() || aEnd >= iGraph.NodeCount() || aState.NodeCount() != iGraph.NodeCount() ||
+            !aBound.ValidFor(iGraph.NodeCount()))
+            return KErrorInvalidArgument;
+        aState.NewSearch();
+        const TPoint end_position = iGraph.NodePosition(aEnd);
+        const double heuristic_factor = iGraph.MetresPerUnit() * aMinCostPerMetre;
+        auto heuristic = [&](uint32 aNode) -> uint32
+            {
+            TPoint p = iGraph.NodePosition(aNode);
+            double dx = double(p.iX) - end_position.iX;
+            double dy = double(p.iY) - end_position.iY;
+            double h = std::floor(std::sqrt(dx * dx + dy * dy) * heuristic_factor);
+            uint32 bound = aBound.LowerBound(aNode,aEnd);
+            if (bound > h)
+                h = bound;
+            return h < UINT32_MAX ? uint32(h) : UINT32_MAX - 1;
+            };
+
+        using TEntry = CCompactSearchState::TEntry;
+        std::greater<TEntry> later;
+        auto& open = aState.iOpen;
+        auto& start = aState.Node(aStart);
+        start.iGeneration = aState.iGeneration;
+        start.iCost = 0;
+        start.iHeuristic = heuristic(aStart);
+        start.iPrevArc = UINT32_MAX;
+        open.push_back(TEntry(start.iHeuristic,aStart));
+        bool found = false;
+        while (!open.empty())
+            {
+            std::pop_heap(open.begin(),open.end(),later);
+            TEntry top = open.back();
+            open.pop_back();
+            uint32 node = top.second;
+            const auto& node_state = aState.Node(node);
+            if (top.first != uint64(node_state.iCost) + node_state.iHeuristic)
+                continue;
+            aState.iSettledNodeCount++;
+            if (node == aEnd)
+                {
+                found = true;
+                break;
+                }
+            const uint32 node_cost = node_state.iCost;
+            for (uint32 arc = iGraph.FirstArc(node); arc < iGraph.EndArc(node); arc++)
+                {
+                uint32 arc_cost = aCostFunction(arc,node_cost);
+                if (arc_cost == UINT32_MAX)
+                    continue;
+                // Costs saturate at UINT32_MAX, which is only reached by routes too costly to be represented.
+                uint64 cost = uint64(node_cost) + arc_cost;
+                if (cost > UINT32_MAX)
+                    cost = UINT32_MAX;
+                uint32 end_node = iGraph.ArcEnd(arc);
+                auto& end_state = aState.Node(end_node);
+                if (end_state.iGeneration != aState.iGeneration)
+                    {
+                    end_state.iGeneration = aState.iGeneration;
+                    end_state.iHeuristic = heuristic(end_node);
+                    }
+                else if (cost >= end_state.iCost)
+                    continue;
+                end_state.iCost = uint32(cost);
+                end_state.iPrevArc = arc;
+                open.push_back(TEntry(cost + end_state.iHeuristic,end_node));
+                std::push_heap(open.begin(),open.end(),later);
+                }
+            }
+
+        if (!found)
+            return KErrorNoRoute;
+        if (aState.Node(aEnd).iCost == UINT32_MAX)
+            return KErrorOverflow;
+        aCost = aState.Node(aEnd).iCost;
+        if (aArcPath)
+            {
+            aArcPath->clear();
+            for (uint32 node = aEnd; aState.Node(node).iPrevArc != UINT32_MAX; )
+                {
+                uint32 arc = aState.Node(node).iPrevArc;
+                aArcPath->push_back(arc);
+                node = ArcStart(arc);
+                }
+            std::reverse(aArcPath->begin(),aArcPath->end());
+            }
+        return KErrorNone;
+        }
+
+    /** Return the graph used by this router. */
+    const CCompactRouterGraph& Graph() const { return iGraph; }
+    /** Return the pool of search states used by this router. */
+    CCompactSearchStatePool& SearchStatePool() { return iPool; }
+
+    private:
+    uint32 ArcStart(uint32 aArc) const
+        {
+        uint32 end_node = iGraph.ArcEnd(aArc);
+        for (uint32 i = iGraph.FirstInArc(end_node); i < iGraph.EndInArc(end_node); i++)
+            if (iGraph.InArc(i) == aArc)
+                return iGraph.InArcStart(i);
+        return UINT32_MAX;
+        }
+
+    const CCompactRouterGraph& iGraph;
+    CCompactSearchStatePool iPool;
+    };
+
+}
+
+#endif
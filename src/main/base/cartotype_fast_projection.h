@@ -0,0 +1,270 @@
+/*
+CARTOTYPE_FAST_PROJECTION.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_FAST_PROJECTION_H__
+#define CARTOTYPE_FAST_PROJECTION_H__
+
+#include <cartotype_base.h>
+#include <cartotype_epsg.h>
+#include <cmath>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    // The AVX2 functions are compiled for AVX2 whatever the target, and used only if the processor supports it.
+    #define CARTOTYPE_FAST_PROJECTION_AVX2
+    #define CARTOTYPE_FAST_PROJECTION_AVX2_TARGET __attribute__((target("avx2,fma")))
+    #include <immintrin.h>
+#elif defined(_MSC_VER) && defined(__AVX2__)
+    #define CARTOTYPE_FAST_PROJECTION_AVX2
+    #define CARTOTYPE_FAST_PROJECTION_AVX2_TARGET
+    #include <immintrin.h>
+#endif
+
+namespace CartoType
+{
+
+/**
+Batch conversion between degrees of longitude and latitude and projected coordinates for the two projections
+used by most maps: spherical Web Mercator (EPSG 3857) and plate carrée (EPSG 4326, projected as
+equirectangular metres). For other projections use CProjection, which uses proj4.
+
+Coordinates are interleaved x and y values, converted in place. Projected coordinates are in metres multiplied by aUnitsPerMetre,
+so that map units of 32nds or 64ths of a metre can be used directly. Latitudes are limited to the range of Web Mercator,
++/- 85.0511287798 degrees, when projecting to Web Mercator.
+
+Web Mercator conversion uses AVX2 if the processor supports it, converting four points at a time using polynomial
+approximations to sine, logarithm, exponential and arctangent. Their results differ from those of the standard library by
+less than 1e-6 metres when projecting and less than 1e-13 degrees when converting to degrees. Otherwise, and for
+the last few points of each batch, the standard library functions are used.
+*/
+class TFastProjection
+    {
+    public:
+    /** Return true if a projection, identified by its EPSG code, can be converted using this class. */
+    static bool Supported(int32 aEpsgCode) { return aEpsgCode == KEpsgWebMercator || aEpsgCode == KEpsgPlateCarree; }
+
+    /** Return true if AVX2 conversion is available on this processor. */
+    static bool SimdAvailable()
+        {
+#if defined(CARTOTYPE_FAST_PROJECTION_AVX2) && (defined(__GNUC__) || defined(__clang__))
+        static const bool available = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        return available;
+#elif defined(CARTOTYPE_FAST_PROJECTION_AVX2)
+        return true;
+#else
+        return false;
+#endif
+        }
+
+    /**
+    Convert aPointCount points in aCoord from degrees to the projection aEpsgCode, in place.
+    Return KErrorUnimplemented if the projection is not supported. SIMD instructions are not used if aUseSimd is false.
+    */
+    static TResult FromDegrees(int32 aEpsgCode,double* aCoord,size_t aPointCount,double aUnitsPerMetre = 1,bool aUseSimd = true)
+        {
+        const double scale = KRadius * KRadiansPerDegree * aUnitsPerMetre;
+        if (aEpsgCode == KEpsgPlateCarree)
+            {
+            for (size_t i = 0; i < aPointCount * 2; i++)
+                aCoord[i] *= scale;
+            return KErrorNone;
+            }
+        if (aEpsgCode != KEpsgWebMercator)
+            return KErrorUnimplemented;
+        size_t done = 0;
+#ifdef CARTOTYPE_FAST_PROJECTION_AVX2
+        if (aUseSimd && SimdAvailable())
+            done = WebMercatorFromDegreesAvx2(aCoord,aPointCount,aUnitsPerMetre);
+#else
+        (void)aUseSimd;
+#endif
+        const double y_scale = KRadius * aUnitsPerMetre;
+        const double max_latitude = KMaxLatitude;
+        for (double* p = aCoord + done * 2; p < aCoord + aPointCount * 2; p += 2)
+            {
+            double latitude = std::min(std::max(p[1],-max_latitude),max_latitude) * KRadiansPerDegree;
+            p[0] *= scale;
+            p[1] = std::log(std::tan(KPi / 4 + latitude / 2)) * y_scale;
+            }
+        return KErrorNone;
+        }
+
+    /**
+    Convert aPointCount points in aCoord from the projection aEpsgCode to degrees, in place.
+    Return KErrorUnimplemented if the projection is not supported. SIMD instructions are not used if aUseSimd is false.
+    */
+    static TResult ToDegrees(int32 aEpsgCode,double* aCoord,size_t aPointCount,double aUnitsPerMetre = 1,bool aUseSimd = true)
+        {
+        const double scale = 1.0 / (KRadius * KRadiansPerDegree * aUnitsPerMetre);
+        if (aEpsgCode == KEpsgPlateCarree)
+            {
+            for (size_t i = 0; i < aPointCount * 2; i++)
+                aCoord[i] *= scale;
+            return KErrorNone;
+            }
+        if (aEpsgCode != KEpsgWebMercator)
+            return KErrorUnimplemented;
+        size_t done = 0;
+#ifdef CARTOTYPE_FAST_PROJECTION_AVX2
+        if (aUseSimd && SimdAvailable())
+            done = WebMercatorToDegreesAvx2(aCoord,aPointCount,aUnitsPerMetre);
+#else
+        (void)aUseSimd;
+#endif
+        const double y_scale = 1.0 / (KRadius * aUnitsPerMetre);
+        for (double* p = aCoord + done * 2; p < aCoord + aPointCount * 2; p += 2)
+            {
+            p[0] *= scale;
+            p[1] = (KPi / 2 - 2 * std::atan(std::exp(-p[1] * y_scale))) / KRadiansPerDegree;
+            }
+        return KErrorNone;
+        }
+
+    private:
+    static constexpr double KRadius = KEquatorialRadiusInMetres;
+    static constexpr double KPi = 3.14159265358979323846;
+    static constexpr double KRadiansPerDegree = KPi / 180;
+    static constexpr double KMaxLatitude = 85.0511287798066;
+
+#ifdef CARTOTYPE_FAST_PROJECTION_AVX2
+    // Return the sine of x, for |x| <= pi / 2, using its Taylor series to x^21.
+    CARTOTYPE_FAST_PROJECTION_AVX2_TARGET static __m256d SinAvx2(__m256d x)
+        {
+        __m256d x2 = _mm256_mul_pd(x,x);
+        __m256d p = _mm256_set1_pd(1.0 / 51090942171709440000.0);
+        p = _mm256_fmadd_pd(p,x2,_mm256_set1_pd(-1.0 / 121645100408832000.0));
+        p = _mm256_fmadd_pd(p,x2,_mm256_set1_pd(1.0 / 355687428096000.0));
+        p = _mm256_fmadd_pd(p,x2,_mm256_set1_pd(-1.0 / 1307674368000.0));
+        p = _mm256_fmadd_pd(p,x2,_mm256_set1_pd(1.0 / 6227020800.0));
+        p = _mm256_fmadd_pd(p,x2,_mm256_set1_pd(-1.0 / 39916800.0));
+        p = _mm256_fmadd_pd(p,x2,_mm256_set1_pd(1.0 / 362880.0));
+        p = _mm256_fmadd_pd(p,x2,_mm256_set1_pd(-1.0 / 5040.0));
+        p = _mm256_fmadd_pd(p,x2,_mm256_set1_pd(1.0 / 120.0));
+        p = _mm256_fmadd_pd(p,x2,_mm256_set1_pd(-1.0 / 6.0));
+        return _mm256_fmadd_pd(_mm256_mul_pd(p,x2),x,x);
+        }
+
+    // Return the natural logarithm of x, for positive finite x. The mantissa m is reduced to [sqrt(1/2),sqrt(2)),
+    // and log(m) = 2 atanh(t), where t = (m - 1) / (m + 1), is summed to t^21.
+    CARTOTYPE_FAST_PROJECTION_AVX2_TARGET static __m256d LogAvx2(__m256d x)
+        {
+        __m256i bits = _mm256_castpd_si256(x);
+        __m256d m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits,_mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL)),
+                                                        _mm256_set1_epi64x(0x3FF0000000000000LL)));
+        // Convert the biased exponent to double by placing it in the mantissa of 2^52.
+        __m256d e = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits,52),_mm256_set1_epi64x(0x4330000000000000LL))),
+                                  _mm256_set1_pd(4503599627370496.0 + 1023));
+        __m256d big = _mm256_cmp_pd(m,_mm256_set1_pd(1.41421356237309504880),_CMP_GT_OQ);
+        m = _mm256_blendv_pd(m,_mm256_mul_pd(m,_mm256_set1_pd(0.5)),big);
+        e = _mm256_add_pd(e,_mm256_and_pd(big,_mm256_set1_pd(1)));
+        __m256d t = _mm256_div_pd(_mm256_sub_pd(m,_mm256_set1_pd(1)),_mm256_add_pd(m,_mm256_set1_pd(1)));
+        __m256d t2 = _mm256_mul_pd(t,t);
+        __m256d p = _mm256_set1_pd(1.0 / 21);
+        for (int k = 19; k >= 3; k -= 2)
+            p = _mm256_fmadd_pd(p,t2,_mm256_set1_pd(1.0 / k));
+        __m256d log_m = _mm256_mul_pd(_mm256_set1_pd(2),_mm256_fmadd_pd(_mm256_mul_pd(p,t2),t,t));
+        return _mm256_fmadd_pd(e,_mm256_set1_pd(0.69314718055994530942),log_m);
+        }
+
+    // Return e^x, for |x| <= 700. x = n log(2) + r, with |r| <= log(2) / 2, and e^r is summed to r^13.
+    CARTOTYPE_FAST_PROJECTION_AVX2_TARGET static __m256d ExpAvx2(__m256d x)
+        {
+        __m256d n = _mm256_round_pd(_mm256_mul_pd(x,_mm256_set1_pd(1.44269504088896340736)),_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256d r = _mm256_fnmadd_pd(n,_mm256_set1_pd(6.93145751953125E-1),x);
+        r = _mm256_fnmadd_pd(n,_mm256_set1_pd(1.42860682030941723212E-6),r);
+        __m256d p = _mm256_set1_pd(1.0 / 6227020800.0);
+        static const double KInverseFactorial[] = { 1.0 / 479001600.0, 1.0 / 39916800.0, 1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0,
+                                                    1.0 / 5040.0, 1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 0.5, 1.0, 1.0 };
+        for (double c : KInverseFactorial)
+            p = _mm256_fmadd_pd(p,r,_mm256_set1_pd(c));
+        __m256i two_to_n = _mm256_slli_epi64(_mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n)),_mm256_set1_epi64x(1023)),52);
+        return _mm256_mul_pd(p,_mm256_castsi256_pd(two_to_n));
+        }
+
+    // Return the arctangent of x, for non-negative x, using the reduction and rational approximation of the Cephes library.
+    CARTOTYPE_FAST_PROJECTION_AVX2_TARGET static __m256d AtanAvx2(__m256d x)
+        {
+        __m256d large = _mm256_cmp_pd(x,_mm256_set1_pd(2.41421356237309504880),_CMP_GT_OQ);
+        __m256d medium = _mm256_andnot_pd(large,_mm256_cmp_pd(x,_mm256_set1_pd(0.66),_CMP_GT_OQ));
+        // For large x, atan(x) = pi / 2 + atan(-1 / x); for medium x, atan(x) = pi / 4 + atan((x - 1) / (x + 1)).
+        __m256d y = _mm256_or_pd(_mm256_and_pd(large,_mm256_set1_pd(KPi / 2)),_mm256_and_pd(medium,_mm256_set1_pd(KPi / 4)));
+        __m256d more_bits = _mm256_or_pd(_mm256_and_pd(large,_mm256_set1_pd(6.123233995736765886130E-17)),
+                                         _mm256_and_pd(medium,_mm256_set1_pd(0.5 * 6.123233995736765886130E-17)));
+        __m256d numerator = _mm256_blendv_pd(x,_mm256_blendv_pd(_mm256_sub_pd(x,_mm256_set1_pd(1)),_mm256_set1_pd(-1),large),_mm256_or_pd(large,medium));
+        __m256d denominator = _mm256_blendv_pd(_mm256_set1_pd(1),_mm256_blendv_pd(_mm256_add_pd(x,_mm256_set1_pd(1)),x,large),_mm256_or_pd(large,medium));
+        x = _mm256_div_pd(numerator,denominator);
+        __m256d z = _mm256_mul_pd(x,x);
+        __m256d p = _mm256_set1_pd(-8.750608600031904122785E-1);
+        p = _mm256_fmadd_pd(p,z,_mm256_set1_pd(-1.615753718733365076637E1));
+        p = _mm256_fmadd_pd(p,z,_mm256_set1_pd(-7.500855792314704667340E1));
+        p = _mm256_fmadd_pd(p,z,_mm256_set1_pd(-1.228866684490136173410E2));
+        p = _mm256_fmadd_pd(p,z,_mm256_set1_pd(-6.485021904942025371773E1));
+        __m256d q = _mm256_add_pd(z,_mm256_set1_pd(2.485846490142306297962E1));
+        q = _mm256_fmadd_pd(q,z,_mm256_set1_pd(1.650270098316988542046E2));
+        q = _mm256_fmadd_pd(q,z,_mm256_set1_pd(4.328810604912902668951E2));
+        q = _mm256_fmadd_pd(q,z,_mm256_set1_pd(4.853903996359136964868E2));
+        q = _mm256_fmadd_pd(q,z,_mm256_set1_pd(1.945506571482613964425E2));
+        __m256d r = _mm256_fmadd_pd(_mm256_div_pd(_mm256_mul_pd(z,p),q),x,x);
+        return _mm256_add_pd(y,_mm256_add_pd(r,more_bits));
+        }
+
+    // Convert as many groups of four points as possible from degrees to Web Mercator, returning the number of points converted.
+    CARTOTYPE_FAST_PROJECTION_AVX2_TARGET static size_t WebMercatorFromDegreesAvx2(double* aCoord,size_t aPointCount,double aUnitsPerMetre)
+        {
+        const __m256d x_scale = _mm256_set1_pd(KRadius * KRadiansPerDegree * aUnitsPerMetre);
+        const __m256d y_scale = _mm256_set1_pd(KRadius * aUnitsPerMetre * 0.5);
+        const __m256d radians_per_degree = _mm256_set1_pd(KRadiansPerDegree);
+        const __m256d max_latitude = _mm256_set1_pd(KMaxLatitude);
+        const __m256d min_latitude = _mm256_set1_pd(-KMaxLatitude);
+        const __m256d one = _mm256_set1_pd(1);
+        size_t count = aPointCount & ~size_t(3);
+        for (double* p = aCoord; p < aCoord + count * 2; p += 8)
+            {
+            // Separate the x and y values; the order of the points in each register does not matter because it is restored on storing.
+            __m256d a = _mm256_loadu_pd(p);
+            __m256d b = _mm256_loadu_pd(p + 4);
+            __m256d x = _mm256_unpacklo_pd(a,b);
+            __m256d y = _mm256_unpackhi_pd(a,b);
+            x = _mm256_mul_pd(x,x_scale);
+            y = _mm256_mul_pd(_mm256_min_pd(_mm256_max_pd(y,min_latitude),max_latitude),radians_per_degree);
+            // y = R atanh(sin(latitude)) = R / 2 * log((1 + sin(latitude)) / (1 - sin(latitude)))
+            __m256d s = SinAvx2(y);
+            y = _mm256_mul_pd(LogAvx2(_mm256_div_pd(_mm256_add_pd(one,s),_mm256_sub_pd(one,s))),y_scale);
+            _mm256_storeu_pd(p,_mm256_unpacklo_pd(x,y));
+            _mm256_storeu_pd(p + 4,_mm256_unpackhi_pd(x,y));
+            }
+        return count;
+        }
+
+    // Convert as many groups of four points as possible from Web Mercator to degrees, returning the number of points converted.
+    CARTOTYPE_FAST_PROJECTION_AVX2_TARGET static size_t WebMercatorToDegreesAvx2(double* aCoord,size_t aPointCount,double aUnitsPerMetre)
+        {
+        const __m256d x_scale = _mm256_set1_pd(1.0 / (KRadius * KRadiansPerDegree * aUnitsPerMetre));
+        const __m256d y_scale = _mm256_set1_pd(-1.0 / (KRadius * aUnitsPerMetre));
+        const __m256d degrees_per_radian = _mm256_set1_pd(1.0 / KRadiansPerDegree);
+        const __m256d max_exponent = _mm256_set1_pd(700);
+        const __m256d min_exponent = _mm256_set1_pd(-700);
+        size_t count = aPointCount & ~size_t(3);
+        for (double* p = aCoord; p < aCoord + count * 2; p += 8)
+            {
+            __m256d a = _mm256_loadu_pd(p);
+            __m256d b = _mm256_loadu_pd(p + 4);
+            __m256d x = _mm256_unpacklo_pd(a,b);
+            __m256d y = _mm256_unpackhi_pd(a,b);
+            x = _mm256_mul_pd(x,x_scale);
+            // latitude = pi / 2 - 2 atan(e^(-y / R))
+            __m256d e = ExpAvx2(_mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(y,y_scale),min_exponent),max_exponent));
+            y = _mm256_mul_pd(_mm256_fnmadd_pd(_mm256_set1_pd(2),AtanAvx2(e),_mm256_set1_pd(KPi / 2)),degrees_per_radian);
+            _mm256_storeu_pd(p,_mm256_unpacklo_pd(x,y));
+            _mm256_storeu_pd(p + 4,_mm256_unpackhi_pd(x,y));
+            }
+        return count;
+        }
+#endif
+    };
+
+}
+
+#endif
@@ -277,6 +277,24 @@ class MFrameworkObserver
     virtual void OnDynamicDataChange() = 0;
     };
 
+/** The parameters for a single map object in a batch inserted or updated by CFramework::InsertMapObjects or CFramework::UpdateMapObjects. */
+class CMapObjectParam
+    {
+    public:
+    /** The type of the object. */
+    TMapObjectType iType = TMapObjectType::Point;
+    /** The name of the layer. */
+    CString iLayerName;
+    /** The geometry of the object. */
+    CGeometry iGeometry;
+    /** The string attributes, in the form used by CFramework::InsertMapObject. */
+    CString iStringAttributes;
+    /** The integer attribute. */
+    int32 iIntAttribute = 0;
+    /** The ID of the object. When inserting, zero causes a new ID to be assigned, which is returned here. */
+    uint64 iId = 0;
+    };
+
 /** Parameters used to set the perspective view. */
 class TPerspectiveParam
     {
@@ -469,6 +487,8 @@ class CFramework: public MNavigatorObserver
                                     double aRadius,TCoordType aRadiusCoordType,
                                     const CString& aStringAttributes,int32 aIntAttribute,uint64& aId,bool aReplace);
     TResult InsertCopyOfMapObject(uint32 aMapHandle,const CString& aLayerName,const CMapObject& aObject,double aEnvelopeRadius,TCoordType aRadiusCoordType,uint64& aId,bool aReplace);
+    TResult InsertMapObjects(uint32 aMapHandle,std::vector<CMapObjectParam>& aObjectArray,bool aReplace);
+    TResult UpdateMapObjects(uint32 aMapHandle,const std::vector<CMapObjectParam>& aObjectArray);
     TResult DeleteMapObjects(uint32 aMapHandle,uint64 aStartId,uint64 aEndId,uint64& aDeletedCount,CString aCondition = nullptr);
     std::unique_ptr<CMapObject> LoadMapObject(TResult& aError,uint32 aMapHandle,uint64 aId);
     TResult ReadGpx(uint32 aMapHandle,const CString& aFileName);
@@ -707,6 +727,8 @@ class CFramework: public MNavigatorObserver
     void ViewChanged() { for (auto p: iFrameworkObservers) p->OnViewChange(); }
     void MainDataChanged() { for (auto p : iFrameworkObservers) p->OnMainDataChange(); }
     void DynamicDataChanged() { for (auto p : iFrameworkObservers) p->OnDynamicDataChange(); }
+    TResult InsertMapObjectFromParam(uint32 aMapHandle,const CMapObjectParam& aParam,uint64& aId,bool aReplace);
+    TResult UpdateMapObjectGeometry(uint32 aMapHandle,uint64 aId,const CGeometry& aGeometry);
 
     // virtual functions from MNavigatorObserver
     void OnTurn(const TNavigatorTurn& aFirstTurn,
@@ -764,8 +786,153 @@ class CFramework: public MNavigatorObserver
     TFollowMode iFollowMode = TFollowMode::LocationHeadingZoom;
     mutable std::string iName; // the name of the dataset as an XML string containing names of maps, style sheets and fonts
     std::shared_ptr<MUserData> iUserData;
+
+    friend class CDynamicDataBatch;
+    };
+
+/**
+A batch of changes to the dynamic data of a framework. While the batch exists, the observers of the framework
+are not notified of changes to dynamic data; when it is destroyed they are notified once if there were any changes.
+Other notifications are passed on immediately. Batches may be nested, and must be destroyed in the reverse
+order of their creation. Observers that were added before the batch was created must not be removed while it exists.
+
+The batch is owned by the caller and holds no state in the framework apart from its temporary place among the
+framework's observers, so it also covers changes made by all the framework's functions, such as DeleteMapObjects.
+*/
+class CDynamicDataBatch: public MFrameworkObserver
+    {
+    public:
+    explicit CDynamicDataBatch(CFramework& aFramework):
+        iFramework(aFramework)
+        {
+        iObserver.swap(iFramework.iFrameworkObservers);
+        iFramework.iFrameworkObservers.insert(this);
+        }
+
+    ~CDynamicDataBatch()
+        {
+        iFramework.iFrameworkObservers.erase(this);
+        iFramework.iFrameworkObservers.insert(iObserver.begin(),iObserver.end());
+        if (iChanged)
+            {
+            for (auto p : iObserver)
+                p->OnDynamicDataChange();
+            }
+        }
+
+    CDynamicDataBatch(const CDynamicDataBatch&) = delete;
+    CDynamicDataBatch& operator=(const CDynamicDataBatch&) = delete;
+
+    private:
+    void OnViewChange() override { for (auto p : iObserver) p->OnViewChange(); }
+    void OnMainDataChange() override { for (auto p : iObserver) p->OnMainDataChange(); }
+    void OnDynamicDataChange() override { iChanged = true; }
+
+    CFramework& iFramework;
+    std::set<MFrameworkObserver*> iObserver;    // the observers hidden from the framework during the batch
+    bool iChanged = false;
     };
 
+/**
+Insert a batch of map objects into the map identified by aMapHandle, which must be writable.
+Observers are notified of the change once for the whole batch, not once for each object.
+The ID of each new object is returned in its iId member. If aReplace is true, objects
+with the same IDs as existing objects replace them.
+
+If an error occurs, no more objects are inserted, but objects before the one causing the error remain in the map.
+*/
+inline TResult CFramework::InsertMapObjects(uint32 aMapHandle,std::vector<CMapObjectParam>& aObjectArray,bool aReplace)
+    {
+    CDynamicDataBatch batch(*this);
+    for (auto& p : aObjectArray)
+        {
+        TResult error = InsertMapObjectFromParam(aMapHandle,p,p.iId,aReplace);
+        if (error)
+            return error;
+        }
+    return KErrorNone;
+    }
+
+/**
+Replace the geometry of a batch of existing point and line objects, identified by their iId members, in the map identified by aMapHandle,
+as when displaying the positions of a fleet of vehicles. Only the iId and iGeometry members are used: the type, layer and attributes
+of each object are kept, and the attributes are copied from the stored object, not parsed again.
+The new geometry must have the same number of contours as the object. Observers are notified of the change once for the whole batch.
+
+Each object is loaded and written back, so this is not faster per object than inserting it again; it saves the notifications
+and the parsing of attributes. Polygons, which may have been created as envelopes or circles, and objects with curves
+cannot be updated, because their shapes cannot be reproduced from new on-curve points.
+
+Return KErrorNotFound if an object does not exist, and KErrorInvalidArgument if it is not a point or line object,
+has curves, or has a different number of contours. If an error occurs, no more objects are updated,
+but objects before the one causing the error remain updated.
+*/
+inline TResult CFramework::UpdateMapObjects(uint32 aMapHandle,const std::vector<CMapObjectParam>& aObjectArray)
+    {
+    CDynamicDataBatch batch(*this);
+    for (const auto& p : aObjectArray)
+        {
+        TResult error = UpdateMapObjectGeometry(aMapHandle,p.iId,p.iGeometry);
+        if (error)
+            return error;
+        }
+    return KErrorNone;
+    }
+
+inline TResult CFramework::InsertMapObjectFromParam(uint32 aMapHandle,const CMapObjectParam& aParam,uint64& aId,bool aReplace)
+    {
+    if (aParam.iType == TMapObjectType::Point && aParam.iGeometry.ContourCount() == 1 && aParam.iGeometry.PointCount(0) == 1)
+        {
+        TPointFP point = aParam.iGeometry.Point(0,0);
+        return InsertPointMapObject(aMapHandle,aParam.iLayerName,point.iX,point.iY,aParam.iGeometry.CoordType(),
+                                    aParam.iStringAttributes,aParam.iIntAttribute,aId,aReplace);
+        }
+    return InsertMapObject(aMapHandle,aParam.iType,aParam.iLayerName,aParam.iGeometry,aParam.iStringAttributes,aParam.iIntAttribute,aId,aReplace);
+    }
+
+inline TResult CFramework::UpdateMapObjectGeometry(uint32 aMapHandle,uint64 aId,const CGeometry& aGeometry)
+    {
+    if (!aId)
+        return KErrorNotFound;
+    TResult error = 0;
+    std::unique_ptr<CMapObject> object = LoadMapObject(error,aMapHandle,aId);
+    if (!error && !object)
+        error = KErrorNotFound;
+    if (error)
+        return error;
+    if (object->Type() != TMapObjectType::Point && object->Type() != TMapObjectType::Line)
+        return KErrorInvalidArgument;
+    size_t contours = aGeometry.ContourCount();
+    if (contours != object->Contours())
+        return KErrorInvalidArgument;
+    for (size_t i = 0; i < contours; i++)
+        {
+        for (const auto& p : object->Contour(i))
+            if (p.iType != TPointType::OnCurve)
+                return KErrorInvalidArgument;
+        }
+    for (size_t i = 0; i < contours; i++)
+        {
+        size_t points = aGeometry.PointCount(i);
+        MWritableContour& contour = object->WritableContour(i);
+        contour.SetSize(points);
+        TOutlinePoint* point = contour.Point();
+        for (size_t j = 0; j < points; j++)
+            {
+            TPointFP p = aGeometry.Point(i,j);
+            if (aGeometry.CoordType() != TCoordType::Map)
+                {
+                error = ConvertPoint(p.iX,p.iY,aGeometry.CoordType(),TCoordType::Map);
+                if (error)
+                    return error;
+                }
+            point[j] = TOutlinePoint(Arithmetic::Round(p.iX),Arithmetic::Round(p.iY),TPointType::OnCurve);
+            }
+        }
+    uint64 id = aId;
+    return InsertCopyOfMapObject(aMapHandle,CString(object->LayerName()),*object,0,TCoordType::Map,id,true);
+    }
+
 /** A framework for finding map objects in a map, when the ability to draw the map is not needed. */
 class CFindFramework
     {
@@ -0,0 +1,441 @@
+/*
+CARTOTYPE_FUZZY_INDEX.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_FUZZY_INDEX_H__
+#define CARTOTYPE_FUZZY_INDEX_H__
+
+#include <cartotype_string.h>
+#include <cartotype_char.h>
+#include <cartotype_stream.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+Fold a string in the way used by fuzzy matching (TStringMatchMethod::Fuzzy):
+remove accents, convert to lower case, and ignore all characters that are not letters or digits.
+The result is a sequence of Unicode code points, which is appended to aOutput.
+*/
+inline void FoldForFuzzyMatch(const MString& aText,std::vector<int32>& aOutput)
+    {
+    const uint16* p = aText.Text();
+    const uint16* end = p + aText.Length();
+    while (p < end)
+        {
+        int32 c = *p++;
+        if (c >= 0xD800 && c <= 0xDBFF && p < end && *p >= 0xDC00 && *p <= 0xDFFF)
+            c = 0x10000 + ((c - 0xD800) << 10) + (*p++ - 0xDC00);
+        TChar ch(c);
+        if (!ch.IsAlphanumeric())
+            continue;
+        int32 lower[TChar::KMaxCaseVariantLength];
+        int32 lower_length = 0;
+        TChar(ch.AccentStripped()).GetLowerCase(lower,lower_length);
+        aOutput.insert(aOutput.end(),lower,lower + lower_length);
+        }
+    }
+
+/**
+A search pattern for calculating Levenshtein edit distances against many texts,
+using the bit-parallel algorithm of Myers (1999), in the form given by Hyyrö (2001) for
+global distances. Patterns of up to 64 characters take time proportional
+to the length of the text; longer patterns use the standard dynamic programming algorithm.
+*/
+class CEditDistancePattern
+    {
+    public:
+    /** Create a pattern from a sequence of characters, as produced by FoldForFuzzyMatch. */
+    CEditDistancePattern(const int32* aPattern,size_t aLength):
+        iPattern(aPattern,aPattern + aLength)
+        {
+        if (aLength <= 64)
+            {
+            for (size_t i = 0; i < aLength; i++)
+                iPeq[aPattern[i]] |= uint64(1) << i;
+            }
+        }
+
+    /** Return the length of the pattern. */
+    size_t Length() const { return iPattern.size(); }
+
+    /** Return the edit distance between the pattern and the whole of aText. */
+    size_t Distance(const int32* aText,size_t aLength) const
+        {
+        return Calculate(aText,aLength,false);
+        }
+
+    /**
+    Return the smallest edit distance between the pattern and any prefix of aText,
+    including the empty prefix. This is the distance to use when the pattern is an
+    incomplete word typed by the user.
+    */
+    size_t PrefixDistance(const int32* aText,size_t aLength) const
+        {
+        return Calculate(aText,aLength,true);
+        }
+
+    private:
+    size_t Calculate(const int32* aText,size_t aLength,bool aPrefix) const
+        {
+        size_t m = iPattern.size();
+        if (m == 0)
+            return aPrefix ? 0 : aLength;
+        if (m > 64)
+            return CalculateSlowly(aText,aLength,aPrefix);
+
+        uint64 last = uint64(1) << (m - 1);
+        uint64 pv = ~uint64(0);
+        uint64 mv = 0;
+        size_t score = m;
+        size_t best = score;
+        for (size_t j = 0; j < aLength; j++)
+            {
+            auto iter = iPeq.find(aText[j]);
+            uint64 eq = iter == iPeq.end() ? 0 : iter->second;
+            uint64 xv = eq | mv;
+            uint64 xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64 ph = mv | ~(xh | pv);
+            uint64 mh = pv & xh;
+            if (ph & last)
+                score++;
+            else if (mh & last)
+                score--;
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+            if (score < best)
+                best = score;
+            }
+        return aPrefix ? best : score;
+        }
+
+    size_t CalculateSlowly(const int32* aText,size_t aLength,bool aPrefix) const
+        {
+        size_t m = iPattern.size();
+        std::vector<size_t> column(m + 1);
+        for (size_t i = 0; i <= m; i++)
+            column[i] = i;
+        size_t best = column[m];
+        for (size_t j = 0; j < aLength; j++)
+            {
+            size_t diagonal = column[0];
+            column[0] = j + 1;
+            for (size_t i = 1; i <= m; i++)
+                {
+                size_t above = column[i];
+                size_t d = diagonal + (iPattern[i - 1] == aText[j] ? 0 : 1);
+                d = std::min(d,above + 1);
+                d = std::min(d,column[i - 1] + 1);
+                column[i] = d;
+                diagonal = above;
+                }
+            best = std::min(best,column[m]);
+            }
+        return aPrefix ? best : column[m];
+        }
+
+    std::vector<int32> iPattern;
+    std::unordered_map<int32,uint64> iPeq;
+    };
+
+/** A string found by CFuzzyTextIndex::Find. */
+class TFuzzyIndexMatch
+    {
+    public:
+    /** The identifier supplied when the string was added to the index. */
+    uint32 iId;
+    /** The edit distance between the search text and the string, or a prefix of it for prefix searches. */
+    uint32 iDistance;
+    };
+
+/**
+A trigram index for fuzzy text searching.
+
+Strings are added with an identifier, such as the index of a map object in a text index, and folded
+as for TStringMatchMethod::Fuzzy. Find uses the q-gram lemma to choose candidates sharing enough
+trigrams with the search text, then verifies them using bit-parallel edit distance. A string
+within edit distance k of the search text shares at least N - 3k of the search text's N distinct trigrams,
+so only strings with many trigrams in common need to be compared.
+
+The index can be created when a map is built, or lazily when it is first needed, and written to a file
+beside the map file using Write, so that it can be loaded quickly using Read.
+*/
+class CFuzzyTextIndex
+    {
+    public:
+    /** Add a string to the index. Call Build after adding all strings and before calling Find. */
+    void Add(uint32 aId,const MString& aText)
+        {
+        iId.push_back(aId);
+        FoldForFuzzyMatch(aText,iText);
+        iTextEnd.push_back(uint32(iText.size()));
+        iBuilt = false;
+        }
+
+    /** Create the inverted trigram lists from the strings added. */
+    void Build()
+        {
+        std::vector<std::pair<uint64,uint32>> gram_array;
+        std::vector<uint64> grams;
+        for (uint32 i = 0; i < iId.size(); i++)
+            {
+            grams.clear();
+            size_t start = 0, length = 0;
+            GetText(i,start,length);
+            GetTrigrams(iText.data() + start,length,false,grams);
+            for (auto g : grams)
+                gram_array.emplace_back(g,i);
+            }
+        std::sort(gram_array.begin(),gram_array.end());
+
+        iGram.clear();
+        iPostingStart.clear();
+        iPosting.clear();
+        iPosting.reserve(gram_array.size());
+        for (const auto& g : gram_array)
+            {
+            if (iGram.empty() || iGram.back() != g.first)
+                {
+                iGram.push_back(g.first);
+                iPostingStart.push_back(uint32(iPosting.size()));
+                }
+            iPosting.push_back(g.second);
+            }
+        iPostingStart.push_back(uint32(iPosting.size()));
+        iBuilt = true;
+        }
+
+    /** Return the number of strings in the index. */
+    size_t Count() const { return iId.size(); }
+
+    /**
+    Find strings within aMaxDistance edits of aText, or, if aPrefix is true, strings
+    with a prefix within aMaxDistance edits of aText, as needed for incremental search.
+    Put up to aMaxCount results in aResult, sorted by distance, then by order of addition.
+    */
+    void Find(std::vector<TFuzzyIndexMatch>& aResult,const MString& aText,size_t aMaxDistance,bool aPrefix,size_t aMaxCount = SIZE_MAX) const
+        {
+        aResult.clear();
+        if (!iBuilt || aMaxCount == 0)
+            return;
+        std::vector<int32> pattern;
+        FoldForFuzzyMatch(aText,pattern);
+        CEditDistancePattern edit_pattern(pattern.data(),pattern.size());
+        std::vector<uint64> grams;
+        GetTrigrams(pattern.data(),pattern.size(),aPrefix,grams);
+
+        auto verify = [&](uint32 aIndex)
+            {
+            size_t start = 0, length = 0;
+            GetText(aIndex,start,length);
+            size_t d = aPrefix ? edit_pattern.PrefixDistance(iText.data() + start,length) : edit_pattern.Distance(iText.data() + start,length);
+            if (d <= aMaxDistance)
+                aResult.push_back({ aIndex,uint32(d) });
+            };
+
+        size_t required = grams.size() > 3 * aMaxDistance ? grams.size() - 3 * aMaxDistance : 0;
+        if (required == 0)
+            {
+            // Too few trigrams to filter on: compare every string.
+            for (uint32 i = 0; i < iId.size(); i++)
+                verify(i);
+            }
+        else
+            {
+            std::vector<uint16> count(iId.size());
+            std::vector<uint32> candidate;
+            for (auto g : grams)
+                {
+                auto p = std::lower_bound(iGram.begin(),iGram.end(),g);
+                if (p == iGram.end() || *p != g)
+                    continue;
+                size_t n = p - iGram.begin();
+                for (uint32 k = iPostingStart[n]; k < iPostingStart[n + 1]; k++)
+                    {
+                    uint32 index = iPosting[k];
+                    if (++count[index] == required)
+                        candidate.push_back(index);
+                    }
+                }
+            std::sort(candidate.begin(),candidate.end());
+            for (auto index : candidate)
+                verify(index);
+            }
+
+        std::stable_sort(aResult.begin(),aResult.end(),[](const TFuzzyIndexMatch& aA,const TFuzzyIndexMatch& aB) { return aA.iDistance < aB.iDistance; });
+        if (aResult.size() > aMaxCount)
+            aResult.resize(aMaxCount);
+        for (auto& r : aResult)
+            r.iId = iId[r.iId];
+        }
+
+    /** Write the index to a stream. */
+    TResult Write(MOutputStream& aOutputStream) const
+        {
+        if (!iBuilt)
+            return KErrorGeneral;
+        TDataOutputStream output(aOutputStream);
+        TResult error = output.WriteUint32(KFileSignature);
+        if (!error)
+            error = output.WriteUint32(KFileVersion);
+        if (!error)
+            error = WriteArray(output,iId);
+        if (!error)
+            error = WriteArray(output,iTextEnd);
+        if (!error)
+            error = WriteArray(output,iText);
+        if (!error)
+            error = WriteArray(output,iGram);
+        if (!error)
+            error = WriteArray(output,iPostingStart);
+        if (!error)
+            error = WriteArray(output,iPosting);
+        return error;
+        }
+
+    /** Read an index written by Write, replacing the current contents. */
+    TResult Read(MInputStream& aInputStream)
+        {
+        TDataInputStream input(aInputStream);
+        TResult error = 0;
+        uint32 signature = input.ReadUint32(error);
+        if (!error && signature != KFileSignature)
+            return KErrorUnknownDataFormat;
+        uint32 version = 0;
+        if (!error)
+            version = input.ReadUint32(error);
+        if (!error && version != KFileVersion)
+            return KErrorUnknownVersion;
+        if (!error)
+            error = ReadArray(input,iId);
+        if (!error)
+            error = ReadArray(input,iTextEnd);
+        if (!error)
+            error = ReadArray(input,iText);
+        if (!error)
+            error = ReadArray(input,iGram);
+        if (!error)
+            error = ReadArray(input,iPostingStart);
+        if (!error)
+            error = ReadArray(input,iPosting);
+        if (!error && !Valid())
+            error = KErrorCorrupt;
+        iBuilt = !error;
+        return error;
+        }
+
+    private:
+    static constexpr uint32 KFileSignature = 0x43544649; // 'CTFI'
+    static constexpr uint32 KFileVersion = 1;
+
+    // Check that the arrays read from a file are consistent, so that searches stay within them.
+    bool Valid() const
+        {
+        if (iTextEnd.size() != iId.size() || iPostingStart.size() != iGram.size() + 1)
+            return false;
+        uint32 prev = 0;
+        for (auto end : iTextEnd)
+            {
+            if (end < prev)
+                return false;
+            prev = end;
+            }
+        if (prev != iText.size())
+            return false;
+        for (size_t i = 1; i < iGram.size(); i++)
+            if (iGram[i] <= iGram[i - 1])
+                return false;
+        prev = 0;
+        for (auto start : iPostingStart)
+            {
+            if (start < prev)
+                return false;
+            prev = start;
+            }
+        if (prev != iPosting.size())
+            return false;
+        for (auto index : iPosting)
+            if (index >= iId.size())
+                return false;
+        return true;
+        }
+
+    void GetText(uint32 aIndex,size_t& aStart,size_t& aLength) const
+        {
+        aStart = aIndex ? iTextEnd[aIndex - 1] : 0;
+        aLength = iTextEnd[aIndex] - aStart;
+        }
+
+    /**
+    Get the distinct trigrams of a folded string, padded at the start with two null characters
+    so that short strings and initial letters produce trigrams. Strings, but not prefixes, are
+    also padded at the end.
+    */
+    static void GetTrigrams(const int32* aText,size_t aLength,bool aPrefix,std::vector<uint64>& aGrams)
+        {
+        aGrams.clear();
+        if (aLength == 0)
+            return;
+        std::vector<int32> padded(aLength + 4,0);
+        std::copy(aText,aText + aLength,padded.begin() + 2);
+        size_t gram_count = aPrefix ? aLength : aLength + 2;
+        for (size_t i = 0; i < gram_count; i++)
+            aGrams.push_back((uint64(uint32(padded[i]) & 0x1FFFFF) << 42) | (uint64(uint32(padded[i + 1]) & 0x1FFFFF) << 21) | (uint32(padded[i + 2]) & 0x1FFFFF));
+        std::sort(aGrams.begin(),aGrams.end());
+        aGrams.erase(std::unique(aGrams.begin(),aGrams.end()),aGrams.end());
+        }
+
+    template<class T> static TResult WriteArray(TDataOutputStream& aOutput,const std::vector<T>& aArray)
+        {
+        TResult error = aOutput.WriteUint32(uint32(aArray.size()));
+        for (size_t i = 0; !error && i < aArray.size(); i++)
+            {
+            uint64 value = uint64(aArray[i]);
+            if (sizeof(T) > 4)
+                error = aOutput.WriteUint32(uint32(value >> 32));
+            if (!error)
+                error = aOutput.WriteUint32(uint32(value));
+            }
+        return error;
+        }
+
+    template<class T> static TResult ReadArray(TDataInputStream& aInput,std::vector<T>& aArray)
+        {
+        TResult error = 0;
+        uint32 size = aInput.ReadUint32(error);
+        aArray.clear();
+        // Reserve no more than a limited amount in advance, so that a corrupt size cannot cause a huge allocation.
+        const uint32 max_reserve = 1 << 20;
+        if (!error)
+            aArray.reserve(size < max_reserve ? size : max_reserve);
+        for (uint32 i = 0; !error && i < size; i++)
+            {
+            uint64 value = 0;
+            if (sizeof(T) > 4)
+                value = uint64(aInput.ReadUint32(error)) << 32;
+            if (!error)
+                value |= aInput.ReadUint32(error);
+            aArray.push_back(T(value));
+            }
+        return error;
+        }
+
+    std::vector<uint32> iId;
+    std::vector<uint32> iTextEnd;
+    std::vector<int32> iText;
+    std::vector<uint64> iGram;
+    std::vector<uint32> iPostingStart;
+    std::vector<uint32> iPosting;
+    bool iBuilt = false;
+    };
+
+}
+
+#endif
@@ -0,0 +1,241 @@
+/*
+CARTOTYPE_GEOMETRY_ARENA.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_GEOMETRY_ARENA_H__
+#define CARTOTYPE_GEOMETRY_ARENA_H__
+
+#include <cartotype_path.h>
+#include <cartotype_transform.h>
+#include <cartotype_arithmetic.h>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A store for the geometry of many objects, held as a structure of arrays: separate arrays of x and y coordinates,
+bit sets giving the types of the points, and the offsets of the contours and objects.
+
+Compared with a CContour for each object, which holds a vector of TOutlinePoint, the geometry takes 8 bytes and 2 bits
+for each point instead of 12 bytes, there is one allocation for all the objects instead of one for each object, and
+loops over the coordinates, such as those in Bounds, Offset and Transform, use contiguous arrays of numbers that the
+compiler can vectorise. Existing code that needs an MPath can use Path, which copies the points of one object on first use.
+*/
+class CGeometryArena
+    {
+    public:
+    /** A path giving access to the geometry of one object in an arena. The arena must not be changed while the path is in use. */
+    class TObjectPath: public MPath
+        {
+        public:
+        TObjectPath(const CGeometryArena& aArena,size_t aObject):
+            iArena(aArena),
+            iObject(aObject)
+            {
+            }
+
+        // Virtual functions from MPath.
+        size_t Contours() const override { return iArena.ContourCount(iObject); }
+        void GetContour(size_t aIndex,TContour& aContour) const override
+            {
+            size_t first_point = iArena.FirstPoint(iObject);
+            if (iPoint.empty() && iArena.EndPoint(iObject) > first_point)
+                iArena.GetPoints(iPoint,first_point,iArena.EndPoint(iObject));
+            size_t contour = iArena.iObjectStart[iObject] + aIndex;
+            size_t start = iArena.iContourStart[contour] - first_point;
+            size_t end = iArena.iContourStart[contour + 1] - first_point;
+            aContour = TContour(iPoint.data() + start,end - start,iArena.ContourClosed(contour),iArena.iHasCurves);
+            }
+        bool MayHaveCurves() const override { return iArena.iHasCurves; }
+
+        private:
+        const CGeometryArena& iArena;
+        size_t iObject;
+        mutable std::vector<TOutlinePoint> iPoint;  // the points of the object, copied when first needed
+        };
+
+    CGeometryArena():
+        iContourStart(1,0)
+        {
+        }
+
+    /** Remove all the objects, keeping the memory for reuse. */
+    void Clear()
+        {
+        iX.clear();
+        iY.clear();
+        iControlPoint.clear();
+        iCubicPoint.clear();
+        iContourStart.resize(1);
+        iContourClosed.clear();
+        iObjectStart.clear();
+        iHasCurves = false;
+        }
+
+    /** Start a new object, to which contours are added using AddContour, and return its index. */
+    size_t AddObject()
+        {
+        iObjectStart.push_back(ContourCount());
+        return iObjectStart.size() - 1;
+        }
+
+    /** Add an object with the contours of aPath and return its index. */
+    size_t AddObject(const MPath& aPath)
+        {
+        size_t object = AddObject();
+        TContour contour;
+        for (size_t i = 0; i < aPath.Contours(); i++)
+            {
+            aPath.GetContour(i,contour);
+            AddContour(contour.Point(),contour.Points(),contour.Closed());
+            }
+        return object;
+        }
+
+    /** Add a contour to the last object. */
+    void AddContour(const TOutlinePoint* aPoint,size_t aPointCount,bool aClosed)
+        {
+        assert(!iObjectStart.empty());
+        size_t start = PointCount();
+        size_t end = start + aPointCount;
+        iX.resize(end);
+        iY.resize(end);
+        size_t words = (end + 63) / 64;
+        iControlPoint.resize(words);
+        iCubicPoint.resize(words);
+        for (size_t i = 0; i < aPointCount; i++)
+            {
+            iX[start + i] = aPoint[i].iX;
+            iY[start + i] = aPoint[i].iY;
+            if (aPoint[i].iType != TPointType::OnCurve)
+                {
+                size_t p = start + i;
+                iControlPoint[p / 64] |= uint64(1) << (p % 64);
+                if (aPoint[i].iType == TPointType::Cubic)
+                    iCubicPoint[p / 64] |= uint64(1) << (p % 64);
+                iHasCurves = true;
+                }
+            }
+        iContourStart.push_back(end);
+        size_t contour = iContourClosed.size();
+        iContourClosed.resize(contour + 1);
+        iContourClosed[contour] = aClosed;
+        }
+
+    /** Return the number of objects. */
+    size_t ObjectCount() const { return iObjectStart.size(); }
+    /** Return the total number of contours. */
+    size_t ContourCount() const { return iContourClosed.size(); }
+    /** Return the number of contours of an object. */
+    size_t ContourCount(size_t aObject) const { return ObjectEndContour(aObject) - iObjectStart[aObject]; }
+    /** Return the total number of points. */
+    size_t PointCount() const { return iX.size(); }
+    /** Return the index of the first point of an object. The points of an object are contiguous. */
+    size_t FirstPoint(size_t aObject) const { return iContourStart[iObjectStart[aObject]]; }
+    /** Return the index after the last point of an object. */
+    size_t EndPoint(size_t aObject) const { return iContourStart[ObjectEndContour(aObject)]; }
+    /** Return true if any point is a curve control point. */
+    bool HasCurves() const { return iHasCurves; }
+
+    /** Return the array of x coordinates. */
+    const int32* X() const { return iX.data(); }
+    /** Return the array of y coordinates. */
+    const int32* Y() const { return iY.data(); }
+    /** Return the type of a point. */
+    TPointType PointType(size_t aPoint) const
+        {
+        uint64 bit = uint64(1) << (aPoint % 64);
+        if (!(iControlPoint[aPoint / 64] & bit))
+            return TPointType::OnCurve;
+        return (iCubicPoint[aPoint / 64] & bit) ? TPointType::Cubic : TPointType::Quadratic;
+        }
+    /** Return the index of the first point of a contour, numbering all the contours in the arena together. */
+    size_t ContourStart(size_t aContour) const { return iContourStart[aContour]; }
+    /** Return the index after the last point of a contour, numbering all the contours in the arena together. */
+    size_t ContourEnd(size_t aContour) const { return iContourStart[aContour + 1]; }
+    /** Return true if a contour, numbering all the contours in the arena together, is closed. */
+    bool ContourClosed(size_t aContour) const { return iContourClosed[aContour]; }
+    /** Return a path giving access to the geometry of an object. */
+    TObjectPath Path(size_t aObject) const { return TObjectPath(*this,aObject); }
+
+    /** Copy the points from aStart up to aEnd into aPoint, replacing its contents. */
+    void GetPoints(std::vector<TOutlinePoint>& aPoint,size_t aStart,size_t aEnd) const
+        {
+        aPoint.resize(aEnd - aStart);
+        for (size_t i = aStart; i < aEnd; i++)
+            aPoint[i - aStart] = TOutlinePoint(iX[i],iY[i],iHasCurves ? PointType(i) : TPointType::OnCurve);
+        }
+
+    /** Return the bounds of an object's points, including control points, with the greatest x and y as the right and bottom edges. */
+    TRect Bounds(size_t aObject) const { return Bounds(FirstPoint(aObject),EndPoint(aObject)); }
+
+    /** Return the bounds of the points from aStart up to aEnd. */
+    TRect Bounds(size_t aStart,size_t aEnd) const
+        {
+        if (aStart >= aEnd)
+            return TRect();
+        const int32* x = iX.data();
+        const int32* y = iY.data();
+        int32 min_x = x[aStart], max_x = x[aStart], min_y = y[aStart], max_y = y[aStart];
+        for (size_t i = aStart; i < aEnd; i++)
+            {
+            min_x = x[i] < min_x ? x[i] : min_x;
+            max_x = x[i] > max_x ? x[i] : max_x;
+            min_y = y[i] < min_y ? y[i] : min_y;
+            max_y = y[i] > max_y ? y[i] : max_y;
+            }
+        return TRect(min_x,min_y,max_x,max_y);
+        }
+
+    /** Offset the points from aStart up to aEnd by (aDx,aDy). */
+    void Offset(int32 aDx,int32 aDy,size_t aStart,size_t aEnd)
+        {
+        int32* x = iX.data();
+        int32* y = iY.data();
+        for (size_t i = aStart; i < aEnd; i++)
+            {
+            x[i] += aDx;
+            y[i] += aDy;
+            }
+        }
+
+    /** Transform the points from aStart up to aEnd by aTransform, rounding to the nearest integer. */
+    void Transform(const TTransformFP& aTransform,size_t aStart,size_t aEnd)
+        {
+        const double a = aTransform.A(), b = aTransform.B(), c = aTransform.C(), d = aTransform.D(), tx = aTransform.Tx(), ty = aTransform.Ty();
+        int32* x = iX.data();
+        int32* y = iY.data();
+        for (size_t i = aStart; i < aEnd; i++)
+            {
+            double px = x[i], py = y[i];
+            x[i] = Arithmetic::Round(a * px + c * py + tx);
+            y[i] = Arithmetic::Round(b * px + d * py + ty);
+            }
+        }
+
+    /** Return the number of bytes of memory reserved by the arena. */
+    size_t MemoryUsed() const
+        {
+        return (iX.capacity() + iY.capacity()) * sizeof(int32) + (iControlPoint.capacity() + iCubicPoint.capacity()) * sizeof(uint64) +
+               iContourStart.capacity() * sizeof(size_t) + iContourClosed.capacity() / 8 + iObjectStart.capacity() * sizeof(size_t);
+        }
+
+    private:
+    size_t ObjectEndContour(size_t aObject) const { return aObject + 1 < iObjectStart.size() ? iObjectStart[aObject + 1] : ContourCount(); }
+
+    std::vector<int32> iX;
+    std::vector<int32> iY;
+    std::vector<uint64> iControlPoint;      // a bit for each point, set if it is a control point
+    std::vector<uint64> iCubicPoint;        // a bit for each point, set if it is a cubic control point
+    std::vector<size_t> iContourStart;      // the first point of each contour, and a final entry equal to the number of points
+    std::vector<bool> iContourClosed;
+    std::vector<size_t> iObjectStart;       // the first contour of each object
+    bool iHasCurves = false;
+    };
+
+}
+
+#endif
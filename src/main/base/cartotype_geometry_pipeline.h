@@ -0,0 +1,441 @@
+/*
+CARTOTYPE_GEOMETRY_PIPELINE.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_GEOMETRY_PIPELINE_H__
+#define CARTOTYPE_GEOMETRY_PIPELINE_H__
+
+#include <cartotype_path.h>
+#include <cartotype_fast_projection.h>
+#include <cartotype_arithmetic.h>
+#include <functional>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A buffer holding the geometry of many objects, as produced by CGeometryPipeline.
+All the points are stored in one array, so adding objects allocates memory only when the buffer grows,
+and clearing the buffer keeps its memory for reuse by the next batch.
+*/
+class CGeometryBuffer
+    {
+    public:
+    /** A path giving access to the geometry of one object in a buffer, without copying it. */
+    class TObjectPath: public MPath
+        {
+        public:
+        TObjectPath(const CGeometryBuffer& aBuffer,size_t aObject):
+            iBuffer(aBuffer),
+            iObject(aObject)
+            {
+            }
+
+        // Virtual functions from MPath.
+        size_t Contours() const override { return iBuffer.ContourCount(iObject); }
+        void GetContour(size_t aIndex,TContour& aContour) const override { aContour = iBuffer.Contour(iObject,aIndex); }
+        bool MayHaveCurves() const override { return false; }
+
+        private:
+        const CGeometryBuffer& iBuffer;
+        size_t iObject;
+        };
+
+    /** Remove all the objects, keeping the memory for reuse. */
+    void Clear()
+        {
+        iPoint.clear();
+        iContour.clear();
+        iObjectStart.clear();
+        }
+
+    /** Return the number of objects. */
+    size_t ObjectCount() const { return iObjectStart.size(); }
+    /** Return the number of contours of an object. */
+    size_t ContourCount(size_t aObject) const { return ObjectEnd(aObject) - iObjectStart[aObject]; }
+    /** Return a contour of an object. The contour refers to the buffer's memory and is valid until the buffer is next changed. */
+    TContour Contour(size_t aObject,size_t aIndex) const
+        {
+        const TContourInfo& c = iContour[iObjectStart[aObject] + aIndex];
+        return TContour(iPoint.data() + c.iStart,c.iEnd - c.iStart,c.iClosed,false);
+        }
+    /** Return a path giving access to the geometry of an object. It is valid until the buffer is next changed. */
+    TObjectPath Path(size_t aObject) const { return TObjectPath(*this,aObject); }
+    /** Return the total number of points. */
+    size_t PointCount() const { return iPoint.size(); }
+    /** Return the number of bytes of memory reserved by the buffer. */
+    size_t MemoryUsed() const
+        {
+        return iPoint.capacity() * sizeof(TOutlinePoint) + iContour.capacity() * sizeof(TContourInfo) + iObjectStart.capacity() * sizeof(size_t);
+        }
+
+    private:
+    friend class CGeometryPipeline;
+
+    class TContourInfo
+        {
+        public:
+        size_t iStart;
+        size_t iEnd;
+        bool iClosed;
+        };
+
+    size_t ObjectEnd(size_t aObject) const { return aObject + 1 < iObjectStart.size() ? iObjectStart[aObject + 1] : iContour.size(); }
+
+    std::vector<TOutlinePoint> iPoint;
+    std::vector<TContourInfo> iContour;
+    std::vector<size_t> iObjectStart;   // the index in iContour of the first contour of each object
+    };
+
+/**
+A pipeline to project, clip and simplify the geometry of many map objects, as when importing map data
+or creating vector tiles.
+
+Each contour is projected in one batch, using TFastProjection or a supplied function, and then clipped and
+simplified in a single pass over its points, with the output written directly to a CGeometryBuffer.
+Clipping uses a Sutherland-Hodgman stage for each edge of the clip rectangle, chained so that each point passes
+through all of them in turn; open contours are split where they leave the clip rectangle. Simplification
+removes points while the area of the triangle made by every removed point and the line replacing it is no greater
+than the resolution area.
+
+Input contours contain on-curve points only. An open contour may be a single point, as used for point objects;
+open contours of more than one point that are reduced to a single point are dropped. Objects that are clipped
+away completely are still added to the buffer, with no contours, so that objects in the buffer have the same
+indexes as the objects added.
+A pipeline may be used by only one thread at a time.
+*/
+class CGeometryPipeline
+    {
+    public:
+    /** A function to project coordinates in place: aCoord holds aPointCount points as interleaved x and y values. */
+    using TProjectFunction = std::function<TResult(double* aCoord,size_t aPointCount)>;
+
+    /** Set the projection to be used: input coordinates are in degrees, and are projected using the projection aEpsgCode. */
+    TResult SetProjection(int32 aEpsgCode,double aUnitsPerMetre = 1)
+        {
+        if (!TFastProjection::Supported(aEpsgCode))
+            return KErrorUnimplemented;
+        iProject = [aEpsgCode,aUnitsPerMetre](double* aCoord,size_t aPointCount)
+            {
+            return TFastProjection::FromDegrees(aEpsgCode,aCoord,aPointCount,aUnitsPerMetre);
+            };
+        return KErrorNone;
+        }
+
+    /** Set a function to project input coordinates to map coordinates; if it is null, input coordinates are already map coordinates. */
+    void SetProjection(TProjectFunction aProjectFunction) { iProject = aProjectFunction; }
+    /** Set the clip rectangle, in map coordinates. */
+    void SetClip(const TRect& aClip) { iClip = aClip; iHasClip = true; }
+    /** Stop clipping. */
+    void ClearClip() { iHasClip = false; }
+    /** Set the resolution area used to simplify contours, in square map units. Contours are not simplified if it is zero or less. */
+    void SetResolutionArea(double aResolutionArea) { iResolutionArea = aResolutionArea; }
+
+    /**
+    Process an object and add the result to aBuffer. The object has aContourCount contours, the number of points in which
+    are in aContourPointCount, and the coordinates of which are in aCoord, as interleaved x and y values.
+    If aClosed is true the object is a polygon, otherwise it is a polyline.
+    */
+    TResult AddObject(CGeometryBuffer& aBuffer,const double* aCoord,const size_t* aContourPointCount,size_t aContourCount,bool aClosed)
+        {
+        aBuffer.iObjectStart.push_back(aBuffer.iContour.size());
+        for (size_t i = 0; i < aContourCount; i++)
+            {
+            size_t point_count = aContourPointCount[i];
+            TResult error = AddContour(aBuffer,aCoord,point_count,aClosed);
+            if (error)
+                {
+                // Remove the partly added object.
+                aBuffer.iContour.resize(aBuffer.iObjectStart.back());
+                aBuffer.iPoint.resize(aBuffer.iContour.empty() ? 0 : aBuffer.iContour.back().iEnd);
+                aBuffer.iObjectStart.pop_back();
+                return error;
+                }
+            aCoord += point_count * 2;
+            }
+        return KErrorNone;
+        }
+
+    private:
+    static constexpr size_t KMaxSimplifyWindow = 32;    // the most consecutive points that can be removed by simplification
+
+    TResult AddContour(CGeometryBuffer& aBuffer,const double* aCoord,size_t aPointCount,bool aClosed)
+        {
+        if (aPointCount == 0)
+            return KErrorNone;
+
+        // Project the points in one batch, then round them to map units, finding their bounds.
+        iCoord.assign(aCoord,aCoord + aPointCount * 2);
+        if (iProject)
+            {
+            TResult error = iProject(iCoord.data(),aPointCount);
+            if (error)
+                return error;
+            }
+        double min_x = INT32_MAX, min_y = INT32_MAX, max_x = INT32_MIN, max_y = INT32_MIN;
+        for (auto& c : iCoord)
+            c = Arithmetic::Round(std::min(std::max(c,double(INT32_MIN)),double(INT32_MAX)));
+        for (size_t i = 0; i < aPointCount * 2; i += 2)
+            {
+            min_x = std::min(min_x,iCoord[i]);
+            max_x = std::max(max_x,iCoord[i]);
+            min_y = std::min(min_y,iCoord[i + 1]);
+            max_y = std::max(max_y,iCoord[i + 1]);
+            }
+
+        iBuffer = &aBuffer;
+        iClosed = aClosed;
+        iMinPoints = aClosed ? 3 : (aPointCount == 1 ? 1 : 2);
+        bool clip = iHasClip && !(min_x >= iClip.Left() && max_x <= iClip.Right() && min_y >= iClip.Top() && max_y <= iClip.Bottom());
+        if (iHasClip && (max_x < iClip.Left() || min_x > iClip.Right() || max_y < iClip.Top() || min_y > iClip.Bottom()))
+            return KErrorNone;
+        const double* p = iCoord.data();
+        const double* end = p + aPointCount * 2;
+        if (!clip)
+            {
+            BeginOutputContour();
+            for (; p < end; p += 2)
+                OutputPoint(p[0],p[1]);
+            EndOutputContour();
+            }
+        else if (aClosed)
+            {
+            BeginOutputContour();
+            for (auto& s : iStage)
+                s.iStarted = false;
+            for (; p < end; p += 2)
+                ClipPoint(0,p[0],p[1]);
+            ClosePolygon(0);
+            EndOutputContour();
+            }
+        else if (aPointCount == 1)
+            {
+            // A point object: ClipLine needs two points, so keep the point if it is inside the clip rectangle.
+            if (Inside(0,p[0],p[1]) && Inside(1,p[0],p[1]) && Inside(2,p[0],p[1]) && Inside(3,p[0],p[1]))
+                {
+                BeginOutputContour();
+                OutputPoint(p[0],p[1]);
+                EndOutputContour();
+                }
+            }
+        else
+            {
+            bool output_started = false;
+            for (p += 2; p < end; p += 2)
+                ClipLine(p[-2],p[-1],p[0],p[1],output_started);
+            if (output_started)
+                EndOutputContour();
+            }
+        return KErrorNone;
+        }
+
+    // The state of a Sutherland-Hodgman clipping stage: stages 0 to 3 clip against the left, right, top and bottom edges.
+    class TClipStage
+        {
+        public:
+        bool iStarted;
+        bool iPrevInside;
+        double iFirstX, iFirstY;
+        double iPrevX, iPrevY;
+        };
+
+    bool Inside(size_t aStage,double aX,double aY) const
+        {
+        switch (aStage)
+            {
+            case 0: return aX >= iClip.Left();
+            case 1: return aX <= iClip.Right();
+            case 2: return aY >= iClip.Top();
+            default: return aY <= iClip.Bottom();
+            }
+        }
+
+    // Pass on the point where the line from (aX0,aY0) to (aX1,aY1) crosses the edge of a stage.
+    void ClipIntersection(size_t aStage,double aX0,double aY0,double aX1,double aY1)
+        {
+        double x, y;
+        if (aStage < 2)
+            {
+            x = aStage == 0 ? iClip.Left() : iClip.Right();
+            y = aY0 + (aY1 - aY0) * (x - aX0) / (aX1 - aX0);
+            }
+        else
+            {
+            y = aStage == 2 ? iClip.Top() : iClip.Bottom();
+            x = aX0 + (aX1 - aX0) * (y - aY0) / (aY1 - aY0);
+            }
+        ClipPoint(aStage + 1,x,y);
+        }
+
+    void ClipPoint(size_t aStage,double aX,double aY)
+        {
+        if (aStage == 4)
+            {
+            OutputPoint(aX,aY);
+            return;
+            }
+        TClipStage& s = iStage[aStage];
+        bool inside = Inside(aStage,aX,aY);
+        if (!s.iStarted)
+            {
+            s.iStarted = true;
+            s.iFirstX = aX;
+            s.iFirstY = aY;
+            }
+        else if (inside != s.iPrevInside)
+            ClipIntersection(aStage,s.iPrevX,s.iPrevY,aX,aY);
+        if (inside)
+            ClipPoint(aStage + 1,aX,aY);
+        s.iPrevInside = inside;
+        s.iPrevX = aX;
+        s.iPrevY = aY;
+        }
+
+    // Clip the closing edge of each stage in turn.
+    void ClosePolygon(size_t aStage)
+        {
+        if (aStage == 4)
+            return;
+        TClipStage& s = iStage[aStage];
+        if (s.iStarted && Inside(aStage,s.iFirstX,s.iFirstY) != s.iPrevInside)
+            ClipIntersection(aStage,s.iPrevX,s.iPrevY,s.iFirstX,s.iFirstY);
+        ClosePolygon(aStage + 1);
+        }
+
+    // Clip a line of an open contour using the Liang-Barsky method, starting and ending output contours as it enters and leaves.
+    void ClipLine(double aX0,double aY0,double aX1,double aY1,bool& aOutputStarted)
+        {
+        double t0 = 0, t1 = 1;
+        double dx = aX1 - aX0, dy = aY1 - aY0;
+        auto clip = [&](double aP,double aQ) -> bool
+            {
+            if (aP == 0)
+                return aQ >= 0;
+            double t = aQ / aP;
+            if (aP < 0)
+                {
+                if (t > t1)
+                    return false;
+                if (t > t0)
+                    t0 = t;
+                }
+            else
+                {
+                if (t < t0)
+                    return false;
+                if (t < t1)
+                    t1 = t;
+                }
+            return true;
+            };
+        bool visible = clip(-dx,aX0 - iClip.Left()) && clip(dx,iClip.Right() - aX0) &&
+                       clip(-dy,aY0 - iClip.Top()) && clip(dy,iClip.Bottom() - aY0);
+        if (!visible)
+            {
+            if (aOutputStarted)
+                {
+                EndOutputContour();
+                aOutputStarted = false;
+                }
+            return;
+            }
+        if (!aOutputStarted)
+            {
+            BeginOutputContour();
+            aOutputStarted = true;
+            }
+        OutputPoint(aX0 + t0 * dx,aY0 + t0 * dy);
+        OutputPoint(aX0 + t1 * dx,aY0 + t1 * dy);
+        if (t1 < 1)
+            {
+            EndOutputContour();
+            aOutputStarted = false;
+            }
+        }
+
+    void BeginOutputContour()
+        {
+        iContourStart = iBuffer->iPoint.size();
+        iHasCandidate = false;
+        iRemovedCount = 0;
+        }
+
+    // Add a point to the output contour, removing repeated points and simplifying.
+    void OutputPoint(double aX,double aY)
+        {
+        TPoint c(Arithmetic::Round(aX),Arithmetic::Round(aY));
+        auto& point = iBuffer->iPoint;
+        if (iHasCandidate ? c == iCandidate : (point.size() > iContourStart && c == point.back()))
+            return;
+        if (point.size() == iContourStart || iResolutionArea <= 0)
+            {
+            point.emplace_back(c);
+            return;
+            }
+        if (!iHasCandidate)
+            {
+            iCandidate = c;
+            iHasCandidate = true;
+            return;
+            }
+
+        // Replace the candidate by the new point if the candidate and all the points already removed are close enough to the new line.
+        const TPoint a = point.back();
+        bool remove = iRemovedCount < KMaxSimplifyWindow && TriangleArea(a,iCandidate,c) <= iResolutionArea;
+        for (size_t i = 0; remove && i < iRemovedCount; i++)
+            remove = TriangleArea(a,iRemoved[i],c) <= iResolutionArea;
+        if (remove)
+            iRemoved[iRemovedCount++] = iCandidate;
+        else
+            {
+            point.emplace_back(iCandidate);
+            iRemovedCount = 0;
+            }
+        iCandidate = c;
+        }
+
+    void EndOutputContour()
+        {
+        auto& point = iBuffer->iPoint;
+        if (iHasCandidate)
+            point.emplace_back(iCandidate);
+        if (iClosed)
+            {
+            while (point.size() > iContourStart + 1 && point.back() == point[iContourStart])
+                point.pop_back();
+            }
+        if (point.size() - iContourStart < iMinPoints)
+            point.resize(iContourStart);
+        else
+            iBuffer->iContour.push_back(CGeometryBuffer::TContourInfo { iContourStart,point.size(),iClosed });
+        }
+
+    static double TriangleArea(const TPoint& aA,const TPoint& aB,const TPoint& aC)
+        {
+        return std::fabs((double(aB.iX) - aA.iX) * (double(aC.iY) - aA.iY) - (double(aC.iX) - aA.iX) * (double(aB.iY) - aA.iY)) / 2;
+        }
+
+    TProjectFunction iProject;
+    TRect iClip;
+    bool iHasClip = false;
+    double iResolutionArea = 0;
+
+    // The state used while processing a contour.
+    std::vector<double> iCoord;
+    CGeometryBuffer* iBuffer = nullptr;
+    bool iClosed = false;
+    size_t iMinPoints = 2;      // the minimum number of points in an output contour
+    TClipStage iStage[4];
+    size_t iContourStart = 0;
+    bool iHasCandidate = false;
+    TPoint iCandidate;
+    TPoint iRemoved[KMaxSimplifyWindow];
+    size_t iRemovedCount = 0;
+    };
+
+}
+
+#endif
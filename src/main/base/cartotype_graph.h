@@ -8,17 +8,161 @@ See www.cartotype.com for more information.
 #define CARTOTYPE_GRAPH_H__
 
 #include <cartotype_tree.h>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <vector>
 
 namespace CartoType
 {
 
+/**
+A tree of the lowest-cost routes from a set of nodes to a single destination, created by
+TDijkstra::CalculateBackwardTree. It remains valid as long as the arc costs do not change,
+so it can be kept while following a route and used by TDijkstra::CalculateRouteToTree to re-route quickly.
+*/
+template<class TNode,class TArcRef> class CBackwardRouteTree
+    {
+    public:
+    /** The route from a node to the destination. */
+    class TEntry
+        {
+        public:
+        /** The cost of the route from the node to the destination. */
+        uint32 iCost;
+        /** The first arc of the route. */
+        TArcRef iArc;
+        /** The end node of the first arc, or null for the destination itself. */
+        const TNode* iNext;
+        };
+
+    /** Remove all the routes. */
+    void Clear()
+        {
+        iEntry.clear();
+        iDestination = nullptr;
+        iMaxCost = 0;
+        }
+
+    /** Return the destination, or null if the tree has not been created. */
+    const TNode* Destination() const { return iDestination; }
+    /** Return the maximum cost of the routes in the tree. */
+    uint32 MaxCost() const { return iMaxCost; }
+    /** Return the number of nodes in the tree. */
+    size_t Count() const { return iEntry.size(); }
+
+    /** Return the route from aNode to the destination, or null if aNode is not in the tree. */
+    const TEntry* Find(const TNode* aNode) const
+        {
+        auto p = iEntry.find(aNode);
+        return p == iEntry.end() ? nullptr : &p->second;
+        }
+
+    /** Append the arcs of the route from aNode to the destination to aArcArray. Return false if aNode is not in the tree. */
+    bool GetArcs(const TNode* aNode,std::vector<TArcRef>& aArcArray) const
+        {
+        const TEntry* e = Find(aNode);
+        if (!e)
+            return false;
+        while (e->iNext)
+            {
+            aArcArray.push_back(e->iArc);
+            e = Find(e->iNext);
+            }
+        return true;
+        }
+
+    private:
+    template<class TGraph,class TNode2,class TArcRef2> friend class TDijkstra;
+
+    std::unordered_map<const TNode*,TEntry> iEntry;
+    const TNode* iDestination = nullptr;
+    uint32 iMaxCost = 0;
+    };
+
+/**
+The route calculation state of the nodes of a graph used by TDijkstra, with a generation number that makes
+Reset take constant time instead of time proportional to the size of the graph: the state stored in a node
+is valid only if the node's generation number is the current one. The nodes reached since the last Reset
+are kept in a list, which can be used to clean up other per-node data, or to find the nodes whose routes are known.
+
+TNode must have the members uint32 iCost, TArcRef iPrevArc, bool iClosed and uint32 iGeneration, which must be
+initialised to zero. Nodes must not be moved or destroyed while the state is in use, because it keeps pointers
+to every node it has reached so that it can clear their generation numbers itself. A graph can implement the TDijkstra functions Reset, Set, Close, Cost and Previous by calling
+the functions of the same name, and its arc iterators can use Closed to skip closed nodes.
+*/
+template<class TNode,class TArcRef> class CRouteNodeState
+    {
+    public:
+    /**
+    Make all nodes unreached. When the generation number wraps round, which happens once in every
+    2^32 - 1 calls, the generation numbers of all the nodes ever reached are set to zero.
+    */
+    void Reset()
+        {
+        iVisited.clear();
+        if (++iGeneration == 0)
+            {
+            for (auto p : iStamped)
+                p->iGeneration = 0;
+            iStamped.clear();
+            iGeneration = 1;
+            }
+        }
+
+    /** Store the cost and previous arc of a node. */
+    void Set(TNode* aNode,uint32 aCost,TArcRef aPrevArc)
+        {
+        Visit(aNode);
+        aNode->iCost = aCost;
+        aNode->iPrevArc = aPrevArc;
+        }
+
+    /** Close a node. */
+    void Close(TNode* aNode)
+        {
+        Visit(aNode);
+        aNode->iClosed = true;
+        }
+
+    /** Return true if a node has been closed. */
+    bool Closed(const TNode* aNode) const { return aNode->iGeneration == iGeneration && aNode->iClosed; }
+    /** Return true if a node has been reached. */
+    bool Reached(const TNode* aNode) const { return aNode->iGeneration == iGeneration; }
+    /** Return the cost of a node, or UINT32_MAX if it has not been reached. */
+    uint32 Cost(const TNode* aNode) const { return aNode->iGeneration == iGeneration ? aNode->iCost : UINT32_MAX; }
+    /** Return the previous arc on the route to a node, or zero if it has not been reached. */
+    TArcRef Previous(const TNode* aNode) const { return aNode->iGeneration == iGeneration ? aNode->iPrevArc : TArcRef(0); }
+    /** Return the nodes reached since the last Reset, in the order in which they were first reached. */
+    const std::vector<TNode*>& Visited() const { return iVisited; }
+
+    private:
+    void Visit(TNode* aNode)
+        {
+        if (aNode->iGeneration != iGeneration)
+            {
+            if (aNode->iGeneration == 0)
+                iStamped.push_back(aNode);
+            aNode->iGeneration = iGeneration;
+            aNode->iCost = UINT32_MAX;
+            aNode->iPrevArc = TArcRef(0);
+            aNode->iClosed = false;
+            iVisited.push_back(aNode);
+            }
+        }
+
+    uint32 iGeneration = 1;
+    std::vector<TNode*> iVisited;
+    std::vector<TNode*> iStamped;   // every node with a non-zero generation number
+    };
+
 /**
 A class to implement Dijkstra's algorithm for finding the shortest distance from a source node to all
 other nodes, and to store the nodes for which the route has been calculated.
 
 The class TGraph must have the functions:
 
-void Reset() - initialise the graph for a new route calculation;
+void Reset() - initialise the graph for a new route calculation, preferably in constant time using CRouteNodeState;
 void Set(TNode* aNode,uint32 aCost,TArcRef aPrevArc) - store a cost aCost and a previous arc aPrevArc in the node aNode;
 void Close(TNode* aNode) - close a node so that its arcs will not be returned by the arc iterator;
 uint32 Cost(TNode* aNode) - return the cost from a node to the start of the route;
@@ -161,6 +305,121 @@ template<class TGraph,class TNode,class TArcRef> class TDijkstra
         return error;
         }
 
+    /**
+    Calculate isochrones for several cost thresholds in a single search. aMaxCostArray must be in ascending order.
+    aHandler is called for every node reached, with the index of the smallest threshold greater than the node's cost,
+    or aMaxCostArray.size() for nodes on the boundary that are not within any threshold.
+    */
+    TResult CalculateIsochrones(TNode* aStartNode,const std::vector<uint32>& aMaxCostArray,std::function<void (const TNode*,size_t)> aHandler)
+        {
+        assert(std::is_sorted(aMaxCostArray.begin(),aMaxCostArray.end()));
+        if (aMaxCostArray.empty())
+            return KErrorNone;
+        size_t band = 0;
+        return CalculateIsochrone(aStartNode,aMaxCostArray.back(),[this,&aMaxCostArray,&aHandler,&band](const TNode* aNode)
+            {
+            // Nodes are reached in order of increasing cost, so the band never decreases.
+            uint32 cost = iGraph.Cost(const_cast<TNode*>(aNode));
+            while (band < aMaxCostArray.size() && cost >= aMaxCostArray[band])
+                band++;
+            aHandler(aNode,band);
+            });
+        }
+
+    /**
+    Create a tree of the lowest-cost routes to aEndNode from all nodes that can reach it with a cost of no more than aMaxCost.
+    This object must have been created with aOutgoing = false. Creating the tree once, for example after calculating a route,
+    allows CalculateRouteToTree to re-route from anywhere near the route with a small forward search.
+    */
+    TResult CalculateBackwardTree(TNode* aEndNode,uint32 aMaxCost,CBackwardRouteTree<TNode,TArcRef>& aTree)
+        {
+        assert(!iOutgoing);
+        aTree.Clear();
+        aTree.iDestination = aEndNode;
+        aTree.iMaxCost = aMaxCost;
+        std::unordered_map<const TNode*,const TNode*> parent;
+        iParent = &parent;
+        TResult error = 0;
+        iGraph.Reset();
+        iOpen.Clear();
+        Open(aEndNode,0,0);
+        iSteps = 0;
+        while (!error && iOpen.Count())
+            {
+            TNode* n = iOpen.Min();
+            uint32 cost = iGraph.Cost(n);
+            if (cost > aMaxCost)
+                {
+                iOpen.Delete(n);
+                iGraph.Close(n);
+                break;
+                }
+            typename CBackwardRouteTree<TNode,TArcRef>::TEntry& entry = aTree.iEntry[n];
+            entry.iCost = cost;
+            entry.iArc = iGraph.Previous(n);
+            entry.iNext = n == aEndNode ? nullptr : parent[n];
+            error = CalculateRouteStep(n);
+            }
+        iParent = nullptr;
+        return error;
+        }
+
+    /**
+    Find the lowest-cost route from aStartNode to the destination of aTree, by a forward search that stops
+    at nodes in the tree. This object must have been created with aOutgoing = true.
+
+    On success aMeetingNode is the node where the forward search met the tree and aCost is the cost of the whole route.
+    The route from aStartNode to aMeetingNode is given by the previous arcs stored in the graph, as after CalculateRoutes,
+    and the rest of the route is given by aTree.GetArcs(aMeetingNode).
+
+    Return KErrorNoRoute if the tree is not reached with a cost of no more than aMaxCost; the caller should then
+    calculate a new route from scratch.
+    */
+    TResult CalculateRouteToTree(TNode* aStartNode,const CBackwardRouteTree<TNode,TArcRef>& aTree,const TNode*& aMeetingNode,uint32& aCost,uint32 aMaxCost = UINT32_MAX)
+        {
+        assert(iOutgoing);
+        aMeetingNode = nullptr;
+        aCost = UINT32_MAX;
+        TResult error = 0;
+        iGraph.Reset();
+        iOpen.Clear();
+        Open(aStartNode,0,0);
+        iSteps = 0;
+        uint64 best_cost = UINT64_MAX;
+        while (!error && iOpen.Count())
+            {
+            TNode* n = iOpen.Min();
+            uint32 cost = iGraph.Cost(n);
+            if (cost >= best_cost || cost > aMaxCost)
+                {
+                iOpen.Delete(n);
+                iGraph.Close(n);
+                break;
+                }
+
+            // The best route through a node in the tree follows the tree from there, so such nodes need not be expanded.
+            auto entry = aTree.Find(n);
+            if (entry)
+                {
+                if (uint64(cost) + entry->iCost < best_cost)
+                    {
+                    best_cost = uint64(cost) + entry->iCost;
+                    aMeetingNode = n;
+                    }
+                iOpen.Delete(n);
+                iGraph.Close(n);
+                }
+            else
+                error = CalculateRouteStep(n);
+            }
+        if (error)
+            return error;
+        if (!aMeetingNode)
+            return KErrorNoRoute;
+        aCost = uint32(std::min(best_cost,uint64(UINT32_MAX - 1)));
+        return KErrorNone;
+        }
+
     /** Extend an existing query by performing further steps. */
     TResult ExtendRoutes(int32 aMaxSteps,uint32 aMaxCost = UINT32_MAX,TNode* aEndNode = nullptr)
         {
@@ -217,10 +476,18 @@ template<class TGraph,class TNode,class TArcRef> class TDijkstra
             if (iGraph.Previous(end_node))
                 {
                 if (dest_cost < iGraph.Cost(end_node))
+                    {
                     Promote(end_node,dest_cost,iter.Arc());
+                    if (iParent)
+                        (*iParent)[end_node] = aNode;
+                    }
                 }
             else
+                {
                 Open(end_node,dest_cost,iter.Arc());
+                if (iParent)
+                    (*iParent)[end_node] = aNode;
+                }
             }
         return error;
         }
@@ -229,6 +496,7 @@ template<class TGraph,class TNode,class TArcRef> class TDijkstra
     CPointerTree<TNode,uint32> iOpen;
     bool iOutgoing;
     int32 iSteps;
+    std::unordered_map<const TNode*,const TNode*>* iParent = nullptr; // if non-null, receives the node from which each node was reached
     };
 
 }
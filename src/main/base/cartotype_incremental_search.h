@@ -0,0 +1,172 @@
+/*
+CARTOTYPE_INCREMENTAL_SEARCH.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_INCREMENTAL_SEARCH_H__
+#define CARTOTYPE_INCREMENTAL_SEARCH_H__
+
+#include <cartotype_framework.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A type-ahead search session. Call SetText every time the user changes the search text.
+
+When characters are appended to the text, the session narrows the candidates found for the
+previous text using CMapObject::GetMatch instead of searching the map again. This is done only when the
+previous search found all its matches (that is, it was not truncated by the maximum object count),
+and the match method finds prefixes but is not fuzzy, because only then are the new results a subset of the previous ones.
+When characters are deleted, the results for the shorter text are taken from a small history stack
+if they are still there. Any other change starts a new search.
+*/
+class CIncrementalSearch
+    {
+    public:
+    /** A function to search the map for up to aMaxObjectCount objects matching aText. */
+    using TSearchFunction = std::function<TResult(CMapObjectArray& aObjectArray,size_t aMaxObjectCount,const CString& aText)>;
+    /** The type of the results, which are shared with the history stack. */
+    using TResultArray = std::vector<std::shared_ptr<CMapObject>>;
+
+    /**
+    Create a session using an arbitrary search function. aMatchMethod and aAttributes are used
+    to narrow the previous results by calling CMapObject::GetMatch, and must find the same objects as aSearchFunction.
+    An empty aAttributes means all attributes.
+    */
+    CIncrementalSearch(TSearchFunction aSearchFunction,size_t aMaxObjectCount,TStringMatchMethod aMatchMethod,const CString& aAttributes = nullptr,size_t aMaxHistory = 32):
+        iSearchFunction(aSearchFunction),
+        iMaxObjectCount(aMaxObjectCount),
+        iMatchMethod(aMatchMethod),
+        iAttributes(aAttributes),
+        iMaxHistory(aMaxHistory ? aMaxHistory : 1)
+        {
+        }
+
+    /** Create a session using CFramework::FindText. */
+    static std::unique_ptr<CIncrementalSearch> ForText(CFramework& aFramework,size_t aMaxObjectCount,TStringMatchMethod aMatchMethod,
+                                                       const CString& aLayers,const CString& aAttributes)
+        {
+        TSearchFunction f = [&aFramework,aMatchMethod,aLayers,aAttributes](CMapObjectArray& aObjectArray,size_t aMax,const CString& aText)
+            {
+            return aFramework.FindText(aObjectArray,aMax,aText,aMatchMethod,aLayers,aAttributes);
+            };
+        return std::unique_ptr<CIncrementalSearch>(new CIncrementalSearch(f,aMaxObjectCount,aMatchMethod,aAttributes));
+        }
+
+    /** Create a session using CFramework::FindAddressPart in incremental mode. */
+    static std::unique_ptr<CIncrementalSearch> ForAddressPart(CFramework& aFramework,size_t aMaxObjectCount,TAddressPart aAddressPart,bool aFuzzy)
+        {
+        TSearchFunction f = [&aFramework,aAddressPart,aFuzzy](CMapObjectArray& aObjectArray,size_t aMax,const CString& aText)
+            {
+            return aFramework.FindAddressPart(aObjectArray,aMax,aText,aAddressPart,aFuzzy,true);
+            };
+        TStringMatchMethod method = TStringMatchMethod(uint32(aFuzzy ? TStringMatchMethod::Fuzzy : TStringMatchMethod::Loose) | TStringMatchMethodFlag::Prefix);
+        return std::unique_ptr<CIncrementalSearch>(new CIncrementalSearch(f,aMaxObjectCount,method));
+        }
+
+    /** Set the search text and update the results. */
+    TResult SetText(const CString& aText)
+        {
+        // Discard history entries that are not prefixes of the new text.
+        while (!iHistory.empty() && !IsPrefix(iHistory.back().iText,aText))
+            iHistory.pop_back();
+
+        if (!iHistory.empty() && iHistory.back().iText.Length() == aText.Length())
+            {
+            iNarrowedLastTime = false;
+            iSearchedLastTime = false;
+            return KErrorNone;
+            }
+
+        THistoryEntry entry;
+        entry.iText = aText;
+        entry.iResult = std::make_shared<TResultArray>();
+        if (!iHistory.empty() && !iHistory.back().iTruncated && CanNarrow())
+            {
+            const MString* attributes = iAttributes.Length() ? &iAttributes : nullptr;
+            CMapObject::CMatch match;
+            for (const auto& p : *iHistory.back().iResult)
+                if (p->GetMatch(match,aText,iMatchMethod,attributes) == KErrorNone)
+                    entry.iResult->push_back(p);
+            iNarrowedLastTime = true;
+            iSearchedLastTime = false;
+            }
+        else
+            {
+            CMapObjectArray found;
+            TResult error = iSearchFunction(found,iMaxObjectCount,aText);
+            if (error)
+                return error;
+            entry.iTruncated = found.size() >= iMaxObjectCount;
+            entry.iResult->reserve(found.size());
+            for (auto& p : found)
+                entry.iResult->push_back(std::shared_ptr<CMapObject>(std::move(p)));
+            iNarrowedLastTime = false;
+            iSearchedLastTime = true;
+            }
+
+        if (iHistory.size() >= iMaxHistory)
+            iHistory.erase(iHistory.begin());
+        iHistory.push_back(std::move(entry));
+        return KErrorNone;
+        }
+
+    /** Return the current search text. */
+    CString Text() const { return iHistory.empty() ? CString() : iHistory.back().iText; }
+    /** Return the results for the current search text. */
+    const TResultArray& Result() const { return iHistory.empty() ? iEmptyResult : *iHistory.back().iResult; }
+    /** Return true if the results for the current text may be incomplete because the maximum object count was reached. */
+    bool Truncated() const { return !iHistory.empty() && iHistory.back().iTruncated; }
+    /** Return true if the last call to SetText narrowed the previous results rather than searching the map. */
+    bool NarrowedLastTime() const { return iNarrowedLastTime; }
+    /** Return true if the last call to SetText searched the map. */
+    bool SearchedLastTime() const { return iSearchedLastTime; }
+    /** Discard all results and history. */
+    void Clear() { iHistory.clear(); }
+
+    private:
+    class THistoryEntry
+        {
+        public:
+        CString iText;
+        std::shared_ptr<TResultArray> iResult;
+        bool iTruncated = false;
+        };
+
+    bool CanNarrow() const
+        {
+        uint32 m = uint32(iMatchMethod);
+        return (m & TStringMatchMethodFlag::Prefix) && !(m & TStringMatchMethodFlag::Fuzzy);
+        }
+
+    static bool IsPrefix(const MString& aPrefix,const MString& aText)
+        {
+        if (aPrefix.Length() > aText.Length())
+            return false;
+        const uint16* p = aPrefix.Text();
+        const uint16* q = aText.Text();
+        for (size_t i = 0; i < aPrefix.Length(); i++)
+            if (p[i] != q[i])
+                return false;
+        return true;
+        }
+
+    TSearchFunction iSearchFunction;
+    size_t iMaxObjectCount;
+    TStringMatchMethod iMatchMethod;
+    CString iAttributes;
+    size_t iMaxHistory;
+    std::vector<THistoryEntry> iHistory;
+    TResultArray iEmptyResult;
+    bool iNarrowedLastTime = false;
+    bool iSearchedLastTime = false;
+    };
+
+}
+
+#endif
@@ -0,0 +1,306 @@
+/*
+CARTOTYPE_ISOCHRONE.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_ISOCHRONE_H__
+#define CARTOTYPE_ISOCHRONE_H__
+
+#include <cartotype_path.h>
+#include <cartotype_parallel.h>
+#include <algorithm>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A grid used to create isochrone polygons from the nodes reached by a route search,
+such as the nodes passed to the handler of TDijkstra::CalculateIsochrones.
+
+Each node is added with its position and cost. Each grid cell takes the lowest cost of the nodes in it,
+and that cost is spread to neighbouring cells within a dilation distance, so that the areas between roads are filled.
+Polygons for any number of thresholds can then be made from the same grid by tracing the boundaries
+of the cells with costs below each threshold, so nested isochrones share the work of building the grid.
+*/
+class CIsochroneGrid
+    {
+    public:
+    /** The default maximum number of cells in a grid, which limits the memory used to about 12 bytes per cell. */
+    static constexpr size_t KDefaultMaxCellCount = 1 << 22;
+
+    /**
+    Create a grid with cells of size aCellSize in map units, spreading costs to cells up to aDilation cells away.
+    The grid expands to fit the points added, up to aMaxCellCount cells.
+    */
+    CIsochroneGrid(double aCellSize,int32 aDilation = 1,size_t aMaxCellCount = KDefaultMaxCellCount):
+        iCellSize(aCellSize),
+        iDilation(std::max(aDilation,int32(0))),
+        iMaxCellCount(aMaxCellCount)
+        {
+        }
+
+    /** Add a node at position (aX,aY) in map units, reached with cost aCost. */
+    void AddPoint(double aX,double aY,uint32 aCost)
+        {
+        iPoint.push_back({ aX,aY,aCost });
+        iBuilt = false;
+        }
+
+    /** Remove all the points. */
+    void Clear()
+        {
+        iPoint.clear();
+        iCost.clear();
+        iBuilt = false;
+        }
+
+    /**
+    Get the contours of the region of all cells with cost less than aMaxCost.
+    Outer boundaries are anticlockwise and holes are clockwise, when the y axis points upwards as in map coordinates.
+    Return KErrorInvalidArgument if the cell size is not positive, or KErrorOverflow if the points cover more than the maximum number of cells.
+    */
+    TResult GetContours(std::vector<std::vector<TPointFP>>& aContourArray,uint32 aMaxCost)
+        {
+        aContourArray.clear();
+        TResult error = Build();
+        if (error || iPoint.empty())
+            return error;
+
+        // Create the directed boundary edges, with the inside on the left. Each vertex has at most two outgoing edges.
+        const int32 vw = iWidth + 1;
+        const int32 vh = iHeight + 1;
+        std::vector<int32> out(size_t(vw) * vh * 2,-1);
+        auto add_edge = [&](int32 aFromX,int32 aFromY,int32 aToX,int32 aToY)
+            {
+            size_t v = (size_t(aFromY) * vw + aFromX) * 2;
+            int32 to = aToY * vw + aToX;
+            if (out[v] < 0)
+                out[v] = to;
+            else
+                out[v + 1] = to;
+            };
+        for (int32 y = 0; y < iHeight; y++)
+            for (int32 x = 0; x < iWidth; x++)
+                {
+                if (!Inside(x,y,aMaxCost))
+                    continue;
+                if (!Inside(x,y - 1,aMaxCost))
+                    add_edge(x,y,x + 1,y);
+                if (!Inside(x + 1,y,aMaxCost))
+                    add_edge(x + 1,y,x + 1,y + 1);
+                if (!Inside(x,y + 1,aMaxCost))
+                    add_edge(x + 1,y + 1,x,y + 1);
+                if (!Inside(x - 1,y,aMaxCost))
+                    add_edge(x,y + 1,x,y);
+                }
+
+        // Link the edges into closed contours.
+        for (size_t start = 0; start < out.size(); start++)
+            {
+            if (out[start] < 0)
+                continue;
+            std::vector<TPointFP> contour;
+            int32 from = int32(start / 2);
+            int32 to = out[start];
+            out[start] = -1;
+            int32 start_vertex = from;
+            int32 prev_dx = 0, prev_dy = 0;
+            for (;;)
+                {
+                int32 dx = to % vw - from % vw;
+                int32 dy = to / vw - from / vw;
+                if (dx != prev_dx || dy != prev_dy)
+                    contour.push_back(VertexPosition(from % vw,from / vw));
+                prev_dx = dx;
+                prev_dy = dy;
+                from = to;
+                if (from == start_vertex)
+                    break;
+
+                // At a vertex shared by two diagonally adjacent inside cells, turn left, keeping the cells apart.
+                size_t v = size_t(from) * 2;
+                size_t chosen = v;
+                if (out[v] >= 0 && out[v + 1] >= 0)
+                    {
+                    int32 ndx = out[v] % vw - from % vw;
+                    int32 ndy = out[v] / vw - from / vw;
+                    if (dx * ndy - dy * ndx <= 0)
+                        chosen = v + 1;
+                    }
+                else if (out[v] < 0)
+                    chosen = v + 1;
+                to = out[chosen];
+                out[chosen] = -1;
+                }
+            // Remove the first point if it is in the middle of a straight line.
+            if (contour.size() > 2)
+                {
+                const TPointFP& a = contour.back();
+                const TPointFP& b = contour[0];
+                const TPointFP& c = contour[1];
+                if ((b.iX - a.iX) * (c.iY - b.iY) == (b.iY - a.iY) * (c.iX - b.iX))
+                    contour.erase(contour.begin());
+                }
+            aContourArray.push_back(std::move(contour));
+            }
+        return KErrorNone;
+        }
+
+    /** Create a closed geometry object containing the region of all cells with cost less than aMaxCost. */
+    CGeometry Polygon(TResult& aError,uint32 aMaxCost)
+        {
+        CGeometry geometry(TCoordType::Map,true);
+        std::vector<std::vector<TPointFP>> contour_array;
+        aError = GetContours(contour_array,aMaxCost);
+        for (const auto& contour : contour_array)
+            {
+            geometry.BeginContour();
+            for (const auto& p : contour)
+                geometry.AppendPoint(p);
+            }
+        return geometry;
+        }
+
+    /** Create closed geometry objects for each threshold in aMaxCostArray. */
+    TResult GetPolygons(std::vector<CGeometry>& aPolygonArray,const std::vector<uint32>& aMaxCostArray)
+        {
+        aPolygonArray.clear();
+        for (auto max_cost : aMaxCostArray)
+            {
+            TResult error = 0;
+            aPolygonArray.push_back(Polygon(error,max_cost));
+            if (error)
+                {
+                aPolygonArray.clear();
+                return error;
+                }
+            }
+        return KErrorNone;
+        }
+
+    private:
+    class TCostPoint
+        {
+        public:
+        double iX;
+        double iY;
+        uint32 iCost;
+        };
+
+    TResult Build()
+        {
+        if (iBuilt || iPoint.empty())
+            return KErrorNone;
+        if (!(iCellSize > 0) || !std::isfinite(iCellSize))
+            return KErrorInvalidArgument;
+        double min_x = iPoint[0].iX, min_y = iPoint[0].iY, max_x = min_x, max_y = min_y;
+        for (const auto& p : iPoint)
+            {
+            min_x = std::min(min_x,p.iX);
+            min_y = std::min(min_y,p.iY);
+            max_x = std::max(max_x,p.iX);
+            max_y = std::max(max_y,p.iY);
+            }
+
+        // Leave a margin of empty cells so that every boundary is inside the grid.
+        // Check the size in floating point first so that the calculations in integers cannot overflow.
+        double margin = double(iDilation) + 1;
+        double width = std::floor((max_x - min_x) / iCellSize) + 1 + margin * 2;
+        double height = std::floor((max_y - min_y) / iCellSize) + 1 + margin * 2;
+        if (!(width * height <= double(iMaxCellCount)) || width >= INT32_MAX || height >= INT32_MAX)
+            return KErrorOverflow;
+        iOriginX = min_x - margin * iCellSize;
+        iOriginY = min_y - margin * iCellSize;
+        iWidth = int32(width);
+        iHeight = int32(height);
+        iCost.assign(size_t(iWidth) * iHeight,UINT32_MAX);
+        for (const auto& p : iPoint)
+            {
+            int32 x = int32((p.iX - iOriginX) / iCellSize);
+            int32 y = int32((p.iY - iOriginY) / iCellSize);
+            uint32& c = iCost[size_t(y) * iWidth + x];
+            c = std::min(c,p.iCost);
+            }
+
+        // Spread the costs using a separable minimum filter.
+        if (iDilation)
+            {
+            std::vector<uint32> temp(iCost.size());
+            for (int32 y = 0; y < iHeight; y++)
+                for (int32 x = 0; x < iWidth; x++)
+                    {
+                    uint32 c = UINT32_MAX;
+                    for (int32 i = std::max(0,x - iDilation); i <= std::min(iWidth - 1,x + iDilation); i++)
+                        c = std::min(c,iCost[size_t(y) * iWidth + i]);
+                    temp[size_t(y) * iWidth + x] = c;
+                    }
+            for (int32 y = 0; y < iHeight; y++)
+                for (int32 x = 0; x < iWidth; x++)
+                    {
+                    uint32 c = UINT32_MAX;
+                    for (int32 j = std::max(0,y - iDilation); j <= std::min(iHeight - 1,y + iDilation); j++)
+                        c = std::min(c,temp[size_t(j) * iWidth + x]);
+                    iCost[size_t(y) * iWidth + x] = c;
+                    }
+            }
+        iBuilt = true;
+        return KErrorNone;
+        }
+
+    bool Inside(int32 aX,int32 aY,uint32 aMaxCost) const
+        {
+        if (aX < 0 || aY < 0 || aX >= iWidth || aY >= iHeight)
+            return false;
+        return iCost[size_t(aY) * iWidth + aX] < aMaxCost;
+        }
+
+    TPointFP VertexPosition(int32 aX,int32 aY) const
+        {
+        return TPointFP(iOriginX + aX * iCellSize,iOriginY + aY * iCellSize);
+        }
+
+    double iCellSize;
+    int32 iDilation;
+    size_t iMaxCellCount;
+    std::vector<TCostPoint> iPoint;
+    bool iBuilt = false;
+    double iOriginX = 0;
+    double iOriginY = 0;
+    int32 iWidth = 0;
+    int32 iHeight = 0;
+    std::vector<uint32> iCost;
+    };
+
+/**
+Create isochrone polygons for aOriginCount origins in parallel, using aThreadPool.
+aSearchFunction(aOrigin,aGrid) must run a search from the origin with index aOrigin, normally using
+TDijkstra::CalculateIsochrones with a graph used only by the current thread, and add the nodes reached to aGrid.
+Each grid has cells of size aCellSize, a dilation of aDilation cells and at most aMaxCellCount cells, as for CIsochroneGrid;
+KErrorOverflow is returned if the nodes reached from an origin would need more cells.
+On return aPolygonArray[i][j] is the polygon for origin i and threshold j.
+*/
+inline TResult CalculateIsochronePolygons(CThreadPool& aThreadPool,std::vector<std::vector<CGeometry>>& aPolygonArray,size_t aOriginCount,
+                                          const std::vector<uint32>& aMaxCostArray,double aCellSize,int32 aDilation,size_t aMaxCellCount,
+                                          std::function<TResult(size_t aOrigin,CIsochroneGrid& aGrid)> aSearchFunction)
+    {
+    aPolygonArray.clear();
+    aPolygonArray.resize(aOriginCount);
+    std::vector<TResult> error(aOriginCount);
+    aThreadPool.ParallelFor(aOriginCount,[&](size_t aOrigin)
+        {
+        CIsochroneGrid grid(aCellSize,aDilation,aMaxCellCount);
+        error[aOrigin] = aSearchFunction(aOrigin,grid);
+        if (!error[aOrigin])
+            error[aOrigin] = grid.GetPolygons(aPolygonArray[aOrigin],aMaxCostArray);
+        });
+    for (auto e : error)
+        if (e)
+            return e;
+    return KErrorNone;
+    }
+
+}
+
+#endif
@@ -0,0 +1,296 @@
+/*
+CARTOTYPE_LANDMARKS.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_LANDMARKS_H__
+#define CARTOTYPE_LANDMARKS_H__
+
+#include <cartotype_compact_graph.h>
+#include <cartotype_parallel.h>
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+Landmark costs for the ALT (A*, landmarks and triangle inequality) heuristic, after Goldberg and Harrelson,
+'Computing the Shortest Path: A* Search Meets Graph Theory' (2005).
+
+A few landmark nodes are chosen when the map is built, using SelectLandmarks. For each route profile
+the costs of the routes from every landmark to every node and from every node to every landmark are
+calculated, using Calculate, and can be stored with the map using Write and Read. By the triangle
+inequality these give a lower bound for the cost of a route between any two nodes, which is much
+tighter than a straight-line bound for fastest routes on mixed road types; CCompactRouter::Route uses it
+to settle fewer nodes.
+
+Each cost is stored in 16 bits in units chosen separately for each landmark and direction, so the
+table takes 4 bytes per node per landmark. The lower bound allows for the rounding.
+*/
+class CCompactLandmarkCosts
+    {
+    public:
+    /**
+    Choose aCount landmarks in aGraph by the farthest-landmark method, putting their node indexes in aLandmark.
+    The first landmark is the node farthest from aStartNode, and each later one is the node farthest from all the previous
+    ones, using arc lengths and ignoring arc directions, so the landmarks do not depend on the route profile.
+    Fewer landmarks are chosen if there are not enough nodes reachable from aStartNode.
+    */
+    static TResult SelectLandmarks(std::vector<uint32>& aLandmark,const CCompactRouterGraph& aGraph,size_t aCount,uint32 aStartNode = 0)
+        {
+        aLandmark.clear();
+        const uint32 n = aGraph.NodeCount();
+        if (aStartNode >= n)
+            return KErrorInvalidArgument;
+        std::vector<double> distance(n);
+        using TEntry = std::pair<double,uint32>;
+        std::priority_queue<TEntry,std::vector<TEntry>,std::greater<TEntry>> open;
+        std::vector<uint32> source(1,aStartNode);
+        while (aLandmark.size() < aCount)
+            {
+            // Find the node farthest from the sources.
+            std::fill(distance.begin(),distance.end(),-1.0);
+            for (auto node : source)
+                {
+                distance[node] = 0;
+                open.push(TEntry(0,node));
+                }
+            uint32 farthest = source[0];
+            while (!open.empty())
+                {
+                TEntry top = open.top();
+                open.pop();
+                uint32 node = top.second;
+                if (top.first > distance[node])
+                    continue;
+                if (top.first > distance[farthest])
+                    farthest = node;
+                auto relax = [&](uint32 aNode,float aLength)
+                    {
+                    double d = top.first + aLength;
+                    if (distance[aNode] < 0 || d < distance[aNode])
+                        {
+                        distance[aNode] = d;
+                        open.push(TEntry(d,aNode));
+                        }
+                    };
+                for (uint32 arc = aGraph.FirstArc(node); arc < aGraph.EndArc(node); arc++)
+                    relax(aGraph.ArcEnd(arc),aGraph.ArcLength(arc));
+                for (uint32 i = aGraph.FirstInArc(node); i < aGraph.EndInArc(node); i++)
+                    relax(aGraph.InArcStart(i),aGraph.ArcLength(aGraph.InArc(i)));
+                }
+            if (distance[farthest] <= 0)
+                break;
+            aLandmark.push_back(farthest);
+            if (aLandmark.size() == 1)
+                source.clear();
+            source.push_back(farthest);
+            }
+        return KErrorNone;
+        }
+
+    /**
+    Calculate the costs between the landmarks aLandmark and all the nodes of aGraph, using aArcCost.
+    Two searches are made for each landmark; they are run in parallel if aThreadPool is non-null.
+    */
+    TResult Calculate(const CCompactRouterGraph& aGraph,const std::vector<uint32>& aLandmark,const TCompactArcCost& aArcCost,CThreadPool* aThreadPool = nullptr)
+        {
+        const uint32 n = aGraph.NodeCount();
+        for (auto landmark : aLandmark)
+            if (landmark >= n)
+                return KErrorInvalidArgument;
+        iNodeCount = n;
+        iLandmark = aLandmark;
+        iColumnCount = aLandmark.size() * 2;
+        iUnit.assign(iColumnCount,1);
+        iCost.assign(size_t(n) * iColumnCount,0);
+
+        // Column 2i holds the costs from landmark i to each node, and column 2i + 1 the costs from each node to landmark i.
+        auto calculate_column = [&](size_t aColumn)
+            {
+            std::vector<uint32> cost;
+            CalculateCosts(cost,aGraph,aLandmark[aColumn / 2],aArcCost,aColumn % 2 == 0);
+            uint32 max_cost = 0;
+            for (auto c : cost)
+                if (c != UINT32_MAX && c > max_cost)
+                    max_cost = c;
+            const uint16 unknown = KUnknown;
+            uint32 unit = max_cost / (unknown - 1) + 1;
+            iUnit[aColumn] = unit;
+            for (uint32 i = 0; i < n; i++)
+                iCost[size_t(i) * iColumnCount + aColumn] = cost[i] == UINT32_MAX ? unknown : uint16(cost[i] / unit);
+            };
+        if (aThreadPool)
+            aThreadPool->ParallelFor(iColumnCount,calculate_column);
+        else
+            {
+            for (size_t i = 0; i < iColumnCount; i++)
+                calculate_column(i);
+            }
+        return KErrorNone;
+        }
+
+    /** Return a lower bound for the cost of a route from aNode to aTarget. */
+    uint32 LowerBound(uint32 aNode,uint32 aTarget) const
+        {
+        const uint16* node = iCost.data() + size_t(aNode) * iColumnCount;
+        const uint16* target = iCost.data() + size_t(aTarget) * iColumnCount;
+        int64 bound = 0;
+        for (size_t i = 0; i < iColumnCount; i += 2)
+            {
+            // cost(node,target) >= cost(landmark,target) - cost(landmark,node)
+            if (node[i] != KUnknown && target[i] != KUnknown && target[i] > node[i])
+                bound = std::max(bound,int64(target[i] - node[i]) * iUnit[i] - (iUnit[i] - 1));
+            // cost(node,target) >= cost(node,landmark) - cost(target,landmark)
+            if (node[i + 1] != KUnknown && target[i + 1] != KUnknown && node[i + 1] > target[i + 1])
+                bound = std::max(bound,int64(node[i + 1] - target[i + 1]) * iUnit[i + 1] - (iUnit[i + 1] - 1));
+            }
+        return uint32(bound);
+        }
+
+    /** Return the landmarks. */
+    const std::vector<uint32>& Landmarks() const { return iLandmark; }
+    /** Return the number of nodes in the graph for which the costs were calculated. */
+    uint32 NodeCount() const { return iNodeCount; }
+    /** Return true if the costs can be used as a bound for a graph with aNodeCount nodes; CCompactRouter uses this to reject a table made for another graph. */
+    bool ValidFor(uint32 aNodeCount) const { return iColumnCount == 0 || iNodeCount == aNodeCount; }
+    /** Return the number of bytes used by the costs. */
+    size_t MemoryUsed() const { return iCost.size() * sizeof(uint16); }
+
+    /** Write the landmarks and costs to a stream. */
+    TResult Write(MOutputStream& aOutputStream) const
+        {
+        TDataOutputStream output(aOutputStream);
+        TResult error = output.WriteUint32(KFileSignature);
+        if (!error)
+            error = output.WriteUint32(KFileVersion);
+        if (!error)
+            error = output.WriteUint32(iNodeCount);
+        if (!error)
+            error = output.WriteUint32(uint32(iLandmark.size()));
+        for (size_t i = 0; !error && i < iLandmark.size(); i++)
+            error = output.WriteUint32(iLandmark[i]);
+        for (size_t i = 0; !error && i < iColumnCount; i++)
+            error = output.WriteUint32(iUnit[i]);
+        for (size_t i = 0; !error && i < iCost.size(); i++)
+            error = output.WriteUint16(iCost[i]);
+        return error;
+        }
+
+    /** Read landmarks and costs written by Write. */
+    TResult Read(MInputStream& aInputStream)
+        {
+        TDataInputStream input(aInputStream);
+        TResult error = 0;
+        uint32 signature = input.ReadUint32(error);
+        if (!error && signature != KFileSignature)
+            return KErrorUnknownDataFormat;
+        uint32 version = 0;
+        if (!error)
+            version = input.ReadUint32(error);
+        if (!error && version != KFileVersion)
+            return KErrorUnknownVersion;
+        uint32 node_count = 0, landmark_count = 0;
+        if (!error)
+            node_count = input.ReadUint32(error);
+        if (!error)
+            landmark_count = input.ReadUint32(error);
+        if (!error && (landmark_count > KMaxLandmarks || node_count == UINT32_MAX))
+            return KErrorCorrupt;
+        std::vector<uint32> landmark(landmark_count);
+        for (size_t i = 0; !error && i < landmark.size(); i++)
+            {
+            landmark[i] = input.ReadUint32(error);
+            if (!error && landmark[i] >= node_count)
+                error = KErrorCorrupt;
+            }
+        std::vector<uint32> unit(size_t(landmark_count) * 2);
+        for (size_t i = 0; !error && i < unit.size(); i++)
+            {
+            unit[i] = input.ReadUint32(error);
+            if (!error && unit[i] == 0)
+                error = KErrorCorrupt;
+            }
+        std::vector<uint16> cost;
+        const uint64 cost_count = uint64(node_count) * unit.size();
+        if (!error && cost_count > SIZE_MAX)
+            error = KErrorCorrupt;
+        // Reserve no more than a limited amount in advance, so that a corrupt node count cannot cause a huge allocation.
+        const uint64 max_reserve = 1 << 20;
+        if (!error)
+            cost.reserve(size_t(cost_count < max_reserve ? cost_count : max_reserve));
+        for (uint64 i = 0; !error && i < cost_count; i++)
+            {
+            uint16 c = input.ReadUint16(error);
+            if (!error)
+                cost.push_back(c);
+            }
+        if (error)
+            return error;
+        iNodeCount = node_count;
+        iLandmark.swap(landmark);
+        iColumnCount = unit.size();
+        iUnit.swap(unit);
+        iCost.swap(cost);
+        return KErrorNone;
+        }
+
+    private:
+    static constexpr uint32 KFileSignature = 0x4354414C; // 'CTAL'
+    static constexpr uint32 KFileVersion = 1;
+    static constexpr uint32 KMaxLandmarks = 256;
+    static constexpr uint16 KUnknown = 0xFFFF; // the stored value used when there is no route
+
+    // Calculate the costs from aLandmark to every node if aForward is true, otherwise from every node to aLandmark.
+    static void CalculateCosts(std::vector<uint32>& aCost,const CCompactRouterGraph& aGraph,uint32 aLandmark,const TCompactArcCost& aArcCost,bool aForward)
+        {
+        aCost.assign(aGraph.NodeCount(),UINT32_MAX);
+        using TEntry = std::pair<uint32,uint32>;
+        std::priority_queue<TEntry,std::vector<TEntry>,std::greater<TEntry>> open;
+        aCost[aLandmark] = 0;
+        open.push(TEntry(0,aLandmark));
+        while (!open.empty())
+            {
+            TEntry top = open.top();
+            open.pop();
+            uint32 node = top.second;
+            if (top.first > aCost[node])
+                continue;
+            auto relax = [&](uint32 aNode,uint32 aArc)
+                {
+                uint32 arc_cost = aArcCost.Cost(aGraph.ArcFlags(aArc),aGraph.ArcLength(aArc));
+                if (arc_cost == UINT32_MAX)
+                    return;
+                uint64 cost = uint64(top.first) + arc_cost;
+                if (cost < aCost[aNode])
+                    {
+                    aCost[aNode] = uint32(cost);
+                    open.push(TEntry(uint32(cost),aNode));
+                    }
+                };
+            if (aForward)
+                {
+                for (uint32 arc = aGraph.FirstArc(node); arc < aGraph.EndArc(node); arc++)
+                    relax(aGraph.ArcEnd(arc),arc);
+                }
+            else
+                {
+                for (uint32 i = aGraph.FirstInArc(node); i < aGraph.EndInArc(node); i++)
+                    relax(aGraph.InArcStart(i),aGraph.InArc(i));
+                }
+            }
+        }
+
+    uint32 iNodeCount = 0;
+    std::vector<uint32> iLandmark;
+    size_t iColumnCount = 0;        // two columns for each landmark
+    std::vector<uint32> iUnit;      // the unit of the stored costs in each column
+    std::vector<uint16> iCost;      // the stored costs, iColumnCount for each node
+    };
+
+}
+
+#endif
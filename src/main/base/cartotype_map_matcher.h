@@ -0,0 +1,343 @@
+/*
+CARTOTYPE_MAP_MATCHER.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_MAP_MATCHER_H__
+#define CARTOTYPE_MAP_MATCHER_H__
+
+#include <cartotype_navigation.h>
+#include <cartotype_parallel.h>
+#include <cartotype_rtree.h>
+#include <functional>
+#include <limits>
+#include <vector>
+
+namespace CartoType
+{
+
+/** A possible position on a road for a GPS fix, used by CMapMatcher. */
+class TMapMatchCandidate
+    {
+    public:
+    /** The caller-defined identifier of the road. */
+    uint32 iRoad = 0;
+    /** The index of the segment of the road containing the position. */
+    uint32 iSegment = 0;
+    /** The position, in degrees longitude (x) and latitude (y). */
+    TPointFP iPosition;
+    /** The distance of the position along the road from its start, in metres. */
+    double iOffset = 0;
+    /** The distance from the GPS fix to the position, in metres. */
+    double iDistance = 0;
+    };
+
+/** The result of map matching for a single GPS fix. */
+class TMapMatchResult
+    {
+    public:
+    /** True if the fix was matched to a road. */
+    bool iMatched = false;
+    /**
+    True if this fix starts a new matched section, because there was no plausible route
+    from the previous matched fix, or because this is the first matched fix.
+    */
+    bool iBreak = false;
+    /** The time of the fix, copied from TNavigationData::iTime. */
+    double iTime = 0;
+    /** The matched position; valid if iMatched is true. */
+    TMapMatchCandidate iCandidate;
+    };
+
+/** Parameters for CMapMatcher, using the notation of Newson and Krumm, 'Hidden Markov Map Matching Through Noise and Sparseness' (2009). */
+class TMapMatchParam
+    {
+    public:
+    /** The standard deviation of GPS error in metres: sigma z. */
+    double iGpsSigma = 4.07;
+    /** The scale of the exponential distribution of differences between route distance and great circle distance, in metres: beta. */
+    double iBeta = 3;
+    /** The radius in metres within which candidate roads are sought. */
+    double iSearchRadius = 50;
+    /** The maximum number of candidates for each fix. */
+    size_t iMaxCandidates = 8;
+    };
+
+/**
+A spatial index of road segments, used to find candidate positions for GPS fixes.
+Coordinates are in degrees longitude and latitude, stored in the R-tree in units of 10^-7 degrees.
+*/
+class CRoadSegmentIndex
+    {
+    public:
+    /** Add a road, giving it an identifier, which is returned in TMapMatchCandidate::iRoad. */
+    void AddRoad(uint32 aRoad,const TPointFP* aPoint,size_t aPointCount)
+        {
+        double offset = 0;
+        for (size_t i = 1; i < aPointCount; i++)
+            {
+            TSegment s { aPoint[i - 1],aPoint[i],aRoad,uint32(i - 1),offset };
+            offset += GreatCircleDistanceInMeters(s.iStart.iX,s.iStart.iY,s.iEnd.iX,s.iEnd.iY);
+            TRect bounds(Unit(std::min(s.iStart.iX,s.iEnd.iX)),Unit(std::min(s.iStart.iY,s.iEnd.iY)),
+                         Unit(std::max(s.iStart.iX,s.iEnd.iX)),Unit(std::max(s.iStart.iY,s.iEnd.iY)));
+            iLoadArray.emplace_back(uint32(iSegment.size()),bounds);
+            iSegment.push_back(s);
+            }
+        }
+
+    /** Create the spatial index. Call this after adding all the roads. */
+    void Build()
+        {
+        iTree.Load(std::move(iLoadArray));
+        iLoadArray.clear();
+        }
+
+    /**
+    Find the nearest position on each road within aRadius metres of aPosition, returning
+    up to aMaxCount candidates, nearest first.
+    */
+    void FindCandidates(std::vector<TMapMatchCandidate>& aCandidateArray,const TPointFP& aPosition,double aRadius,size_t aMaxCount) const
+        {
+        aCandidateArray.clear();
+        double metres_per_degree_y = KMetresPerDegree;
+        double metres_per_degree_x = KMetresPerDegree * std::cos(aPosition.iY * KDegreesToRadiansDouble);
+        double metres_per_unit = std::min(metres_per_degree_x,metres_per_degree_y) / 1e7;
+        TPoint p(Unit(aPosition.iX),Unit(aPosition.iY));
+        iTree.FindNearest(p,[&](uint32 aIndex,const TRect&,double aBoundsDistance)
+            {
+            if (aBoundsDistance * metres_per_unit > aRadius)
+                return false;
+            const TSegment& s = iSegment[aIndex];
+
+            // Project the position onto the segment using a local planar approximation.
+            double ax = (s.iStart.iX - aPosition.iX) * metres_per_degree_x, ay = (s.iStart.iY - aPosition.iY) * metres_per_degree_y;
+            double bx = (s.iEnd.iX - aPosition.iX) * metres_per_degree_x, by = (s.iEnd.iY - aPosition.iY) * metres_per_degree_y;
+            double dx = bx - ax, dy = by - ay;
+            double length2 = dx * dx + dy * dy;
+            double t = length2 > 0 ? -(ax * dx + ay * dy) / length2 : 0;
+            t = std::max(0.0,std::min(1.0,t));
+            double ex = ax + t * dx, ey = ay + t * dy;
+            double d = std::sqrt(ex * ex + ey * ey);
+            if (d > aRadius)
+                return true;
+
+            TMapMatchCandidate c;
+            c.iRoad = s.iRoad;
+            c.iSegment = s.iIndex;
+            c.iPosition = TPointFP(s.iStart.iX + t * (s.iEnd.iX - s.iStart.iX),s.iStart.iY + t * (s.iEnd.iY - s.iStart.iY));
+            c.iOffset = s.iOffset + t * std::sqrt(length2);
+            c.iDistance = d;
+            for (auto& other : aCandidateArray)
+                if (other.iRoad == c.iRoad)
+                    {
+                    if (c.iDistance < other.iDistance)
+                        other = c;
+                    return true;
+                    }
+            aCandidateArray.push_back(c);
+            return true;
+            });
+        std::sort(aCandidateArray.begin(),aCandidateArray.end(),[](const TMapMatchCandidate& aA,const TMapMatchCandidate& aB) { return aA.iDistance < aB.iDistance; });
+        if (aCandidateArray.size() > aMaxCount)
+            aCandidateArray.resize(aMaxCount);
+        }
+
+    private:
+    static constexpr double KMetresPerDegree = KRadiansToMetres * KDegreesToRadiansDouble;
+
+    class TSegment
+        {
+        public:
+        TPointFP iStart;
+        TPointFP iEnd;
+        uint32 iRoad;
+        uint32 iIndex;
+        double iOffset;
+        };
+
+    static int32 Unit(double aDegrees) { return int32(std::floor(aDegrees * 1e7 + 0.5)); }
+
+    std::vector<TSegment> iSegment;
+    std::vector<std::pair<uint32,TRect>> iLoadArray;
+    CRTree<uint32> iTree;
+    };
+
+/**
+A map matcher using a hidden Markov model and the Viterbi algorithm, after Newson and Krumm (2009).
+
+Candidate road positions for each fix are supplied by a candidate function, normally using CRoadSegmentIndex.
+Route distances between candidates of successive fixes are supplied by a transition function, which is called once
+for each candidate of the earlier fix with all the candidates of the later fix, so that it can use a single
+one-to-many route calculation, such as TDijkstra::CalculateRoutes, for each source.
+*/
+class CMapMatcher
+    {
+    public:
+    /** A function to get candidate positions for a fix. */
+    using TCandidateFunction = std::function<void(std::vector<TMapMatchCandidate>& aCandidateArray,const TNavigationData& aFix)>;
+    /**
+    A function to get the route distances in metres from aFrom to each of aTo, putting them in aDistance, which has the same size as aTo.
+    Use a negative value if there is no route or the route is implausibly long.
+    */
+    using TTransitionFunction = std::function<void(std::vector<double>& aDistance,const TMapMatchCandidate& aFrom,const std::vector<TMapMatchCandidate>& aTo)>;
+
+    CMapMatcher(TCandidateFunction aCandidateFunction,TTransitionFunction aTransitionFunction,const TMapMatchParam& aParam = TMapMatchParam()):
+        iCandidateFunction(aCandidateFunction),
+        iTransitionFunction(aTransitionFunction),
+        iParam(aParam)
+        {
+        }
+
+    /** Create a matcher using a road segment index to find candidates. */
+    CMapMatcher(const CRoadSegmentIndex& aIndex,TTransitionFunction aTransitionFunction,const TMapMatchParam& aParam = TMapMatchParam()):
+        iTransitionFunction(aTransitionFunction),
+        iParam(aParam)
+        {
+        const CRoadSegmentIndex* index = &aIndex;
+        double radius = aParam.iSearchRadius;
+        size_t max_count = aParam.iMaxCandidates;
+        iCandidateFunction = [index,radius,max_count](std::vector<TMapMatchCandidate>& aCandidateArray,const TNavigationData& aFix)
+            {
+            index->FindCandidates(aCandidateArray,aFix.iPosition,radius,max_count);
+            };
+        }
+
+    /**
+    Match a trace, putting one result for each fix in aResultArray. Fixes without a valid position or without
+    any candidates are not matched. If no candidate of a fix can be reached from the previous matched fix,
+    a new section is started at that fix.
+    */
+    TResult Match(std::vector<TMapMatchResult>& aResultArray,const std::vector<TNavigationData>& aTrace) const
+        {
+        aResultArray.clear();
+        aResultArray.resize(aTrace.size());
+        for (size_t i = 0; i < aTrace.size(); i++)
+            aResultArray[i].iTime = aTrace[i].iTime;
+
+        // The current section: for each matched fix, its candidates, and for each candidate its score and back pointer.
+        class TStep
+            {
+            public:
+            size_t iFix;
+            std::vector<TMapMatchCandidate> iCandidate;
+            std::vector<double> iScore;
+            std::vector<size_t> iPrevious;
+            };
+        std::vector<TStep> section;
+        std::vector<TMapMatchCandidate> candidate_array;
+        std::vector<double> distance;
+
+        for (size_t fix = 0; fix < aTrace.size(); fix++)
+            {
+            const TNavigationData& f = aTrace[fix];
+            if (!(f.iValidity & TNavigationData::KPositionValid))
+                continue;
+            iCandidateFunction(candidate_array,f);
+            if (candidate_array.empty())
+                continue;
+
+            TStep step;
+            step.iFix = fix;
+            step.iCandidate = candidate_array;
+            step.iScore.assign(candidate_array.size(),-std::numeric_limits<double>::infinity());
+            step.iPrevious.assign(candidate_array.size(),SIZE_MAX);
+
+            bool reachable = false;
+            if (!section.empty())
+                {
+                const TStep& prev = section.back();
+                const TPointFP& p = aTrace[prev.iFix].iPosition;
+                double straight = GreatCircleDistanceInMeters(p.iX,p.iY,f.iPosition.iX,f.iPosition.iY);
+                for (size_t i = 0; i < prev.iCandidate.size(); i++)
+                    {
+                    if (prev.iScore[i] == -std::numeric_limits<double>::infinity())
+                        continue;
+                    distance.assign(candidate_array.size(),-1);
+                    iTransitionFunction(distance,prev.iCandidate[i],candidate_array);
+                    for (size_t j = 0; j < candidate_array.size(); j++)
+                        {
+                        if (distance[j] < 0)
+                            continue;
+                        double score = prev.iScore[i] + LogTransition(std::abs(straight - distance[j])) + LogEmission(candidate_array[j].iDistance);
+                        if (score > step.iScore[j])
+                            {
+                            step.iScore[j] = score;
+                            step.iPrevious[j] = i;
+                            reachable = true;
+                            }
+                        }
+                    }
+                }
+
+            if (!reachable)
+                {
+                // Start a new section.
+                EndSection(aResultArray,section);
+                for (size_t j = 0; j < candidate_array.size(); j++)
+                    step.iScore[j] = LogEmission(candidate_array[j].iDistance);
+                }
+            section.push_back(std::move(step));
+            }
+        EndSection(aResultArray,section);
+        return KErrorNone;
+        }
+
+    /**
+    Match several traces in parallel using aThreadPool. The candidate and transition functions
+    must be safe to call from several threads at once.
+    */
+    TResult Match(CThreadPool& aThreadPool,std::vector<std::vector<TMapMatchResult>>& aResultArray,const std::vector<std::vector<TNavigationData>>& aTraceArray) const
+        {
+        aResultArray.clear();
+        aResultArray.resize(aTraceArray.size());
+        std::vector<TResult> error(aTraceArray.size());
+        aThreadPool.ParallelFor(aTraceArray.size(),[&](size_t aIndex) { error[aIndex] = Match(aResultArray[aIndex],aTraceArray[aIndex]); });
+        for (auto e : error)
+            if (e)
+                return e;
+        return KErrorNone;
+        }
+
+    private:
+    double LogEmission(double aDistance) const
+        {
+        double z = aDistance / iParam.iGpsSigma;
+        return -0.5 * z * z - std::log(std::sqrt(2 * KPiDouble) * iParam.iGpsSigma);
+        }
+
+    double LogTransition(double aDifference) const
+        {
+        return -aDifference / iParam.iBeta - std::log(iParam.iBeta);
+        }
+
+    // Trace back through a section from its best final candidate, writing the results, and clear it.
+    template<class TStep> static void EndSection(std::vector<TMapMatchResult>& aResultArray,std::vector<TStep>& aSection)
+        {
+        if (aSection.empty())
+            return;
+        const TStep& last = aSection.back();
+        size_t best = 0;
+        for (size_t j = 1; j < last.iScore.size(); j++)
+            if (last.iScore[j] > last.iScore[best])
+                best = j;
+        for (size_t s = aSection.size(); s-- > 0; )
+            {
+            const TStep& step = aSection[s];
+            TMapMatchResult& r = aResultArray[step.iFix];
+            r.iMatched = true;
+            r.iBreak = s == 0;
+            r.iCandidate = step.iCandidate[best];
+            best = step.iPrevious[best];
+            }
+        aSection.clear();
+        }
+
+    TCandidateFunction iCandidateFunction;
+    TTransitionFunction iTransitionFunction;
+    TMapMatchParam iParam;
+    };
+
+}
+
+#endif
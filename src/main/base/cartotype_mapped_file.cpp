@@ -0,0 +1,114 @@
+/*
+CARTOTYPE_MAPPED_FILE.CPP
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#include <cartotype_mapped_file.h>
+#include <stdio.h>
+#include <string.h>
+
+#if (defined(_WIN32) || defined(_WIN64)) && !defined(_WIN32_WCE)
+    #define CARTOTYPE_MAPPED_FILE_WINDOWS
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+    // See cartotype_types.h.
+    #undef DrawText
+    #undef FindText
+    #undef LoadIcon
+#elif defined(__unix__) || defined(__APPLE__)
+    #define CARTOTYPE_MAPPED_FILE_POSIX
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace CartoType
+{
+
+CMappedFile::~CMappedFile()
+    {
+#if defined(CARTOTYPE_MAPPED_FILE_WINDOWS)
+    if (iData && iMapped)
+        UnmapViewOfFile(iData);
+#elif defined(CARTOTYPE_MAPPED_FILE_POSIX)
+    if (iData && iMapped)
+        munmap(const_cast<uint8*>(iData),iSize);
+#endif
+    }
+
+TResult CMappedFile::Open(const char* aFileName)
+    {
+#if defined(CARTOTYPE_MAPPED_FILE_WINDOWS)
+    HANDLE file = CreateFileA(aFileName,GENERIC_READ,FILE_SHARE_READ,nullptr,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return KErrorNotFound;
+    LARGE_INTEGER size;
+    TResult error = GetFileSizeEx(file,&size) && uint64(size.QuadPart) <= SIZE_MAX ? KErrorNone : KErrorIo;
+    if (!error && size.QuadPart)
+        {
+        HANDLE mapping = CreateFileMappingA(file,nullptr,PAGE_READONLY,0,0,nullptr);
+        if (mapping)
+            {
+            // The view keeps the mapping open, so both handles can be closed.
+            iData = static_cast<const uint8*>(MapViewOfFile(mapping,FILE_MAP_READ,0,0,0));
+            CloseHandle(mapping);
+            }
+        if (iData)
+            {
+            iSize = size_t(size.QuadPart);
+            iMapped = true;
+            }
+        else
+            error = KErrorIo;
+        }
+    CloseHandle(file);
+    return error;
+#elif defined(CARTOTYPE_MAPPED_FILE_POSIX)
+    int file = open(aFileName,O_RDONLY);
+    if (file < 0)
+        return KErrorNotFound;
+    struct stat status;
+    TResult error = fstat(file,&status) == 0 && uint64(status.st_size) <= SIZE_MAX ? KErrorNone : KErrorIo;
+    if (!error && status.st_size)
+        {
+        void* p = mmap(nullptr,size_t(status.st_size),PROT_READ,MAP_SHARED,file,0);
+        if (p != MAP_FAILED)
+            {
+            iData = static_cast<const uint8*>(p);
+            iSize = size_t(status.st_size);
+            iMapped = true;
+            }
+        else
+            error = KErrorIo;
+        }
+    close(file);
+    return error;
+#else
+    FILE* file = fopen(aFileName,"rb");
+    if (!file)
+        return KErrorNotFound;
+    TResult error = KErrorNone;
+    std::vector<uint8> buffer(65536);
+    size_t bytes = 0;
+    while ((bytes = fread(buffer.data(),1,buffer.size(),file)) > 0)
+        {
+        iBuffer.resize((iSize + bytes + 7) / 8);
+        memcpy(reinterpret_cast<uint8*>(iBuffer.data()) + iSize,buffer.data(),bytes);
+        iSize += bytes;
+        }
+    if (ferror(file))
+        error = KErrorIo;
+    fclose(file);
+    iData = reinterpret_cast<const uint8*>(iBuffer.data());
+    return error;
+#endif
+    }
+
+}
@@ -0,0 +1,65 @@
+/*
+CARTOTYPE_MAPPED_FILE.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_MAPPED_FILE_H__
+#define CARTOTYPE_MAPPED_FILE_H__
+
+#include <cartotype_types.h>
+#include <cartotype_errors.h>
+#include <memory>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A read-only file mapped into memory. Pages are read from the file only when they are first accessed,
+and are held in the operating system's page cache, so they can be discarded under memory pressure
+and are shared by all the processes and objects using the same file.
+
+On platforms without memory mapping the whole file is read into memory when it is opened.
+The platform-specific code is in cartotype_mapped_file.cpp, so that this header does not include
+the platform headers.
+*/
+class CMappedFile
+    {
+    public:
+    /** Open and map a file. */
+    static std::unique_ptr<CMappedFile> New(TResult& aError,const char* aFileName)
+        {
+        std::unique_ptr<CMappedFile> f(new CMappedFile);
+        aError = f->Open(aFileName);
+        if (aError)
+            f.reset();
+        return f;
+        }
+
+    ~CMappedFile();
+
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+
+    /** Return a pointer to the data. It is aligned to at least eight bytes. */
+    const uint8* Data() const { return iData; }
+    /** Return the size of the file in bytes. */
+    size_t Size() const { return iSize; }
+    /** Return true if the file is mapped, false if it has been read into memory. */
+    bool IsMapped() const { return iMapped; }
+
+    private:
+    CMappedFile() { }
+
+    TResult Open(const char* aFileName);
+
+    const uint8* iData = nullptr;
+    size_t iSize = 0;
+    bool iMapped = false;
+    std::vector<uint64> iBuffer;    // the data, if the file could not be mapped
+    };
+
+}
+
+#endif
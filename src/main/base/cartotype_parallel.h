@@ -0,0 +1,265 @@
+/*
+CARTOTYPE_PARALLEL.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_PARALLEL_H__
+#define CARTOTYPE_PARALLEL_H__
+
+#include <cartotype_map_object.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A fixed set of worker threads used to run loops in parallel.
+The threads are created once, when the pool is constructed, so that
+short parallel operations such as searches made while the user is typing
+do not pay the cost of creating threads.
+*/
+class CThreadPool
+    {
+    public:
+    /**
+    Create a thread pool. If aThreadCount is zero, the number of threads is
+    one less than the number of hardware threads, because the thread calling
+    ParallelFor also does some of the work.
+    */
+    explicit CThreadPool(size_t aThreadCount = 0)
+        {
+        if (aThreadCount == 0)
+            {
+            size_t n = std::thread::hardware_concurrency();
+            aThreadCount = n > 1 ? n - 1 : 0;
+            }
+        for (size_t i = 0; i < aThreadCount; i++)
+            iThreadArray.emplace_back([this] { WorkerLoop(); });
+        }
+
+    ~CThreadPool()
+        {
+            {
+            std::lock_guard<std::mutex> lock(iMutex);
+            iShutDown = true;
+            }
+        iWorkAvailable.notify_all();
+        for (auto& t : iThreadArray)
+            t.join();
+        }
+
+    CThreadPool(const CThreadPool&) = delete;
+    CThreadPool& operator=(const CThreadPool&) = delete;
+
+    /** Return the number of threads that can run a parallel loop, including the calling thread. */
+    size_t Concurrency() const { return iThreadArray.size() + 1; }
+
+    /**
+    Call aFunction(i) for every i in the range 0...aCount - 1, using the worker threads
+    and the calling thread, and return when all the calls have finished.
+    Indexes are handed out one at a time in ascending order, so lower indexes start first.
+    Calls to ParallelFor from different threads are serialized, so aFunction must not itself call ParallelFor on the same pool.
+    */
+    void ParallelFor(size_t aCount,const std::function<void(size_t)>& aFunction)
+        {
+        if (aCount == 0)
+            return;
+        if (aCount == 1 || iThreadArray.empty())
+            {
+            for (size_t i = 0; i < aCount; i++)
+                aFunction(i);
+            return;
+            }
+
+        std::lock_guard<std::mutex> job_lock(iJobMutex);
+            {
+            std::lock_guard<std::mutex> lock(iMutex);
+            iFunction = &aFunction;
+            iCount = aCount;
+            iNext = 0;
+            iBusyWorkers = iThreadArray.size();
+            iJobNumber++;
+            }
+        iWorkAvailable.notify_all();
+        RunItems(aFunction,aCount);
+
+        std::unique_lock<std::mutex> lock(iMutex);
+        iJobDone.wait(lock,[this] { return iBusyWorkers == 0; });
+        iFunction = nullptr;
+        }
+
+    private:
+    void RunItems(const std::function<void(size_t)>& aFunction,size_t aCount)
+        {
+        for (;;)
+            {
+            size_t i = iNext++;
+            if (i >= aCount)
+                break;
+            aFunction(i);
+            }
+        }
+
+    void WorkerLoop()
+        {
+        uint64 job_number = 0;
+        for (;;)
+            {
+            const std::function<void(size_t)>* f = nullptr;
+            size_t count = 0;
+                {
+                std::unique_lock<std::mutex> lock(iMutex);
+                iWorkAvailable.wait(lock,[this,job_number] { return iShutDown || iJobNumber != job_number; });
+                if (iShutDown)
+                    return;
+                job_number = iJobNumber;
+                f = iFunction;
+                count = iCount;
+                }
+            RunItems(*f,count);
+                {
+                std::lock_guard<std::mutex> lock(iMutex);
+                if (--iBusyWorkers == 0)
+                    iJobDone.notify_one();
+                }
+            }
+        }
+
+    std::vector<std::thread> iThreadArray;
+    std::mutex iJobMutex;
+    std::mutex iMutex;
+    std::condition_variable iWorkAvailable;
+    std::condition_variable iJobDone;
+    const std::function<void(size_t)>* iFunction = nullptr;
+    size_t iCount = 0;
+    std::atomic<size_t> iNext { 0 };
+    size_t iBusyWorkers = 0;
+    uint64 iJobNumber = 0;
+    bool iShutDown = false;
+    };
+
+/**
+Shared state for a parallel search, passed to each shard so that it can
+stop early when enough good results have been found by all the shards together.
+*/
+class CParallelFindControl
+    {
+    public:
+    explicit CParallelFindControl(size_t aMaxObjectCount,bool aFast):
+        iMaxObjectCount(aMaxObjectCount),
+        iFast(aFast)
+        {
+        }
+
+    /** Return true if the search has found enough results and the remaining work can be abandoned. */
+    bool Stopped() const { return iStopped.load(std::memory_order_relaxed); }
+
+    /**
+    Record results found by a shard. Results with a full match can never be displaced by results
+    from other shards, so the search stops when there are enough of them. In fast mode, where the
+    first matches are wanted rather than the most relevant ones, any results count.
+    */
+    void AddResults(size_t aFullMatchCount,size_t aTotalCount)
+        {
+        size_t n = (iFound += (iFast ? aTotalCount : aFullMatchCount));
+        if (n >= iMaxObjectCount)
+            iStopped = true;
+        }
+
+    private:
+    size_t iMaxObjectCount;
+    bool iFast;
+    std::atomic<size_t> iFound { 0 };
+    std::atomic<bool> iStopped { false };
+    };
+
+/**
+A function to search a single shard, such as a tile of a tiled data set or a part of a text index.
+It should put up to aMaxObjectCount objects in aObjectArray, and may test aControl.Stopped()
+to abandon its work early. Each shard must use its own data and search objects, for example
+its own CFramework, because the shards are searched concurrently.
+*/
+using TFindShardFunction = std::function<TResult(CMapObjectArray& aObjectArray,size_t aMaxObjectCount,const CParallelFindControl& aControl)>;
+
+/**
+Search several shards in parallel using aThreadPool, and merge the results by relevance,
+putting at most aMaxObjectCount objects in aObjectArray.
+
+Objects are ranked by how well they match aText (full matches, then fuzzy matches, then partial
+matches); objects of equal relevance are kept in shard order, then in the order their shard returned them.
+If aFast is true, the first objects found are wanted rather than the most relevant ones,
+as with TStringMatchMethodFlag::Fast.
+
+Shards not yet started are skipped once enough full matches (or, if aFast is true, any matches) have been found.
+Returns the first error returned by any shard, or KErrorNone.
+*/
+inline TResult ParallelFind(CThreadPool& aThreadPool,CMapObjectArray& aObjectArray,size_t aMaxObjectCount,
+                            const std::vector<TFindShardFunction>& aShardArray,const CString& aText,bool aFast = false)
+    {
+    aObjectArray.clear();
+    if (aMaxObjectCount == 0 || aShardArray.empty())
+        return KErrorNone;
+
+    class TRankedObject
+        {
+        public:
+        CMapObject::TMatchType iMatchType;
+        size_t iShard;
+        size_t iIndex;
+        };
+
+    std::vector<CMapObjectArray> result(aShardArray.size());
+    std::vector<std::vector<TRankedObject>> rank(aShardArray.size());
+    std::vector<TResult> error(aShardArray.size(),KErrorNone);
+    CParallelFindControl control(aMaxObjectCount,aFast);
+
+    aThreadPool.ParallelFor(aShardArray.size(),[&](size_t aShard)
+        {
+        if (control.Stopped())
+            return;
+        error[aShard] = aShardArray[aShard](result[aShard],aMaxObjectCount,control);
+        if (error[aShard])
+            return;
+        size_t full_match_count = 0;
+        rank[aShard].reserve(result[aShard].size());
+        for (size_t i = 0; i < result[aShard].size(); i++)
+            {
+            auto match_type = aText.Length() ? result[aShard][i]->MatchType(aText) : CMapObject::TMatchType::Full;
+            if (match_type == CMapObject::TMatchType::Full)
+                full_match_count++;
+            rank[aShard].push_back({ match_type,aShard,i });
+            }
+        control.AddResults(full_match_count,result[aShard].size());
+        });
+
+    for (auto e : error)
+        if (e)
+            return e;
+
+    std::vector<TRankedObject> merged;
+    for (const auto& r : rank)
+        merged.insert(merged.end(),r.begin(),r.end());
+    if (!aFast)
+        std::stable_sort(merged.begin(),merged.end(),[](const TRankedObject& aA,const TRankedObject& aB)
+            {
+            return aA.iMatchType > aB.iMatchType;
+            });
+    if (merged.size() > aMaxObjectCount)
+        merged.resize(aMaxObjectCount);
+
+    aObjectArray.reserve(merged.size());
+    for (const auto& m : merged)
+        aObjectArray.push_back(std::move(result[m.iShard][m.iIndex]));
+    return KErrorNone;
+    }
+
+}
+
+#endif
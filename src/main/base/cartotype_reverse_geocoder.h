@@ -0,0 +1,309 @@
+/*
+CARTOTYPE_REVERSE_GEOCODER.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_REVERSE_GEOCODER_H__
+#define CARTOTYPE_REVERSE_GEOCODER_H__
+
+#include <cartotype_address.h>
+#include <cartotype_path.h>
+#include <cartotype_parallel.h>
+#include <cartotype_rtree.h>
+#include <array>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A reverse geocoding index for converting large numbers of points to addresses.
+
+It holds the boundaries of areas such as countries, administrative areas, localities and post code areas
+in an R-tree used for point-in-polygon tests, and the lines of named streets, split into segments,
+in an R-tree used for nearest-neighbour searches. After adding the areas and streets, call Build; then
+GetAddress and GetAddresses can be called from any number of threads at once.
+
+All coordinates are map coordinates, as used by CMapObject, and distances are in map units.
+*/
+class CReverseGeocoder
+    {
+    public:
+    /**
+    Add an area of the type given by aPart, which must be an area type (that is, not TAddressPart::Street).
+    Closed contours of aPath are used; holes are handled using the even-odd rule, and their areas are subtracted
+    from the area used to choose the smallest of nested areas.
+    */
+    void AddArea(TAddressPart aPart,const CString& aName,const MPath& aPath)
+        {
+        CArea area;
+        area.iPart = aPart;
+        area.iName = aName;
+        TContour contour;
+        for (size_t i = 0; i < aPath.Contours(); i++)
+            {
+            aPath.GetContour(i,contour);
+            if (contour.Points() < 3)
+                continue;
+            std::vector<TPoint> points(contour.Points());
+            for (size_t j = 0; j < contour.Points(); j++)
+                points[j] = contour.Point(j);
+            area.iContour.push_back(std::move(points));
+            }
+        if (area.iContour.empty())
+            return;
+
+        const size_t contour_count = area.iContour.size();
+        std::vector<double> contour_area(contour_count);
+        std::vector<TRect> contour_bounds(contour_count);
+        for (size_t i = 0; i < contour_count; i++)
+            {
+            const auto& c = area.iContour[i];
+            TRect& bounds = contour_bounds[i];
+            bounds = TRect(c[0].iX,c[0].iY,c[0].iX,c[0].iY);
+            double a = 0;
+            for (size_t j = 0; j < c.size(); j++)
+                {
+                const TPoint& p = c[j];
+                const TPoint& q = c[(j + 1) % c.size()];
+                a += double(p.iX) * q.iY - double(q.iX) * p.iY;
+                bounds.iTopLeft.iX = std::min(bounds.iTopLeft.iX,p.iX);
+                bounds.iTopLeft.iY = std::min(bounds.iTopLeft.iY,p.iY);
+                bounds.iBottomRight.iX = std::max(bounds.iBottomRight.iX,p.iX);
+                bounds.iBottomRight.iY = std::max(bounds.iBottomRight.iY,p.iY);
+                }
+            contour_area[i] = std::abs(a) / 2;
+            }
+
+        // Under the even-odd rule a contour inside an odd number of others is a hole, so its area is subtracted.
+        area.iBounds = contour_bounds[0];
+        for (size_t i = 0; i < contour_count; i++)
+            {
+            const TPoint& p = area.iContour[i][0];
+            size_t depth = 0;
+            for (size_t j = 0; j < contour_count; j++)
+                {
+                const TRect& b = contour_bounds[j];
+                if (j != i && p.iX >= b.Left() && p.iX <= b.Right() && p.iY >= b.Top() && p.iY <= b.Bottom() &&
+                    ContourContains(area.iContour[j],p.iX,p.iY))
+                    depth++;
+                }
+            area.iArea += depth % 2 ? -contour_area[i] : contour_area[i];
+            const TRect& b = contour_bounds[i];
+            area.iBounds.iTopLeft.iX = std::min(area.iBounds.iTopLeft.iX,b.iTopLeft.iX);
+            area.iBounds.iTopLeft.iY = std::min(area.iBounds.iTopLeft.iY,b.iTopLeft.iY);
+            area.iBounds.iBottomRight.iX = std::max(area.iBounds.iBottomRight.iX,b.iBottomRight.iX);
+            area.iBounds.iBottomRight.iY = std::max(area.iBounds.iBottomRight.iY,b.iBottomRight.iY);
+            }
+        iArea.push_back(std::move(area));
+        iBuilt = false;
+        }
+
+    /** Add a street. Each contour of aPath is treated as a polyline. */
+    void AddStreet(const CString& aName,const MPath& aPath)
+        {
+        uint32 street = uint32(iStreetName.size());
+        iStreetName.push_back(aName);
+        TContour contour;
+        for (size_t i = 0; i < aPath.Contours(); i++)
+            {
+            aPath.GetContour(i,contour);
+            for (size_t j = 1; j < contour.Points(); j++)
+                iSegment.push_back({ contour.Point(j - 1),contour.Point(j),street });
+            if (contour.Closed() && contour.Points() > 2)
+                iSegment.push_back({ contour.Point(contour.Points() - 1),contour.Point(0),street });
+            }
+        iBuilt = false;
+        }
+
+    /** Create the spatial indexes. This must be called after adding areas and streets and before getting addresses. */
+    void Build()
+        {
+        std::vector<std::pair<uint32,TRect>> item_array(iArea.size());
+        for (uint32 i = 0; i < iArea.size(); i++)
+            item_array[i] = std::make_pair(i,iArea[i].iBounds);
+        iAreaTree.Load(std::move(item_array));
+
+        item_array.resize(iSegment.size());
+        for (uint32 i = 0; i < iSegment.size(); i++)
+            {
+            const TSegment& s = iSegment[i];
+            item_array[i] = std::make_pair(i,TRect(std::min(s.iStart.iX,s.iEnd.iX),std::min(s.iStart.iY,s.iEnd.iY),
+                                                   std::max(s.iStart.iX,s.iEnd.iX),std::max(s.iStart.iY,s.iEnd.iY)));
+            }
+        iSegmentTree.Load(std::move(item_array));
+        iBuilt = true;
+        }
+
+    /**
+    Get the address of aPoint. Where areas of the same type are nested, the smallest is used.
+    The street is the nearest one within aMaxStreetDistance.
+    Return KErrorNotFound if no area or street was found.
+    */
+    TResult GetAddress(CAddress& aAddress,const TPoint& aPoint,double aMaxStreetDistance) const
+        {
+        aAddress.Clear();
+        if (!iBuilt)
+            return KErrorGeneral;
+        bool found = false;
+
+        std::array<const CArea*,size_t(TAddressPart::PostCode) + 1> smallest = { };
+        iAreaTree.Find(TRect(aPoint.iX,aPoint.iY,aPoint.iX,aPoint.iY),[&](uint32 aIndex,const TRect&)
+            {
+            const CArea& area = iArea[aIndex];
+            const CArea*& s = smallest[size_t(area.iPart)];
+            if ((!s || area.iArea < s->iArea) && area.Contains(aPoint))
+                s = &area;
+            return true;
+            });
+        for (const CArea* area : smallest)
+            if (area)
+                {
+                CString* field = Field(aAddress,area->iPart);
+                if (field)
+                    {
+                    *field = area->iName;
+                    found = true;
+                    }
+                }
+
+        const TSegment* nearest = nullptr;
+        double nearest_distance = aMaxStreetDistance;
+        iSegmentTree.FindNearest(aPoint,[&](uint32 aIndex,const TRect&,double aBoundsDistance)
+            {
+            if (aBoundsDistance > nearest_distance)
+                return false;
+            double d = iSegment[aIndex].Distance(aPoint);
+            if (d <= nearest_distance)
+                {
+                nearest_distance = d;
+                nearest = &iSegment[aIndex];
+                }
+            return true;
+            });
+        if (nearest)
+            {
+            aAddress.iStreet = iStreetName[nearest->iStreet];
+            found = true;
+            }
+
+        return found ? KErrorNone : KErrorNotFound;
+        }
+
+    /**
+    Get the addresses of aCount points, putting them in aAddressArray, using aThreadPool if it is non-null.
+    Points for which no address was found get empty addresses.
+    */
+    TResult GetAddresses(std::vector<CAddress>& aAddressArray,const TPoint* aPoint,size_t aCount,double aMaxStreetDistance,CThreadPool* aThreadPool = nullptr) const
+        {
+        if (!iBuilt)
+            return KErrorGeneral;
+        aAddressArray.clear();
+        aAddressArray.resize(aCount);
+        const size_t KBlockSize = 256;
+        size_t blocks = (aCount + KBlockSize - 1) / KBlockSize;
+        auto get_block = [&](size_t aBlock)
+            {
+            size_t end = std::min(aCount,(aBlock + 1) * KBlockSize);
+            for (size_t i = aBlock * KBlockSize; i < end; i++)
+                GetAddress(aAddressArray[i],aPoint[i],aMaxStreetDistance);
+            };
+        if (aThreadPool)
+            aThreadPool->ParallelFor(blocks,get_block);
+        else
+            {
+            for (size_t i = 0; i < blocks; i++)
+                get_block(i);
+            }
+        return KErrorNone;
+        }
+
+    private:
+    // Return true if (aX,aY) is inside aContour, using the crossing-number test.
+    static bool ContourContains(const std::vector<TPoint>& aContour,double aX,double aY)
+        {
+        bool inside = false;
+        for (size_t i = 0, j = aContour.size() - 1; i < aContour.size(); j = i++)
+            {
+            double yi = aContour[i].iY, yj = aContour[j].iY;
+            if ((yi > aY) != (yj > aY))
+                {
+                double xi = aContour[i].iX, xj = aContour[j].iX;
+                if (aX < xi + (aY - yi) * (xj - xi) / (yj - yi))
+                    inside = !inside;
+                }
+            }
+        return inside;
+        }
+
+    class CArea
+        {
+        public:
+        bool Contains(const TPoint& aPoint) const
+            {
+            bool inside = false;
+            for (const auto& c : iContour)
+                if (ContourContains(c,aPoint.iX,aPoint.iY))
+                    inside = !inside;
+            return inside;
+            }
+
+        TAddressPart iPart = TAddressPart::Country;
+        CString iName;
+        std::vector<std::vector<TPoint>> iContour;
+        TRect iBounds;
+        double iArea = 0;
+        };
+
+    class TSegment
+        {
+        public:
+        double Distance(const TPoint& aPoint) const
+            {
+            double dx = double(iEnd.iX) - iStart.iX;
+            double dy = double(iEnd.iY) - iStart.iY;
+            double px = double(aPoint.iX) - iStart.iX;
+            double py = double(aPoint.iY) - iStart.iY;
+            double length2 = dx * dx + dy * dy;
+            double t = length2 > 0 ? (px * dx + py * dy) / length2 : 0;
+            t = std::max(0.0,std::min(1.0,t));
+            double ex = px - t * dx;
+            double ey = py - t * dy;
+            return std::sqrt(ex * ex + ey * ey);
+            }
+
+        TPoint iStart;
+        TPoint iEnd;
+        uint32 iStreet;
+        };
+
+    static CString* Field(CAddress& aAddress,TAddressPart aPart)
+        {
+        switch (aPart)
+            {
+            case TAddressPart::Building: return &aAddress.iBuilding;
+            case TAddressPart::Feature: return &aAddress.iFeature;
+            case TAddressPart::Street: return &aAddress.iStreet;
+            case TAddressPart::SubLocality: return &aAddress.iSubLocality;
+            case TAddressPart::Locality: return &aAddress.iLocality;
+            case TAddressPart::Island: return &aAddress.iIsland;
+            case TAddressPart::SubAdminArea: return &aAddress.iSubAdminArea;
+            case TAddressPart::AdminArea: return &aAddress.iAdminArea;
+            case TAddressPart::Country: return &aAddress.iCountry;
+            case TAddressPart::PostCode: return &aAddress.iPostCode;
+            }
+        return nullptr;
+        }
+
+    std::vector<CArea> iArea;
+    std::vector<CString> iStreetName;
+    std::vector<TSegment> iSegment;
+    CRTree<uint32> iAreaTree;
+    CRTree<uint32> iSegmentTree;
+    bool iBuilt = false;
+    };
+
+}
+
+#endif
@@ -0,0 +1,113 @@
+/*
+CARTOTYPE_ROUTE_SUMMARY.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_ROUTE_SUMMARY_H__
+#define CARTOTYPE_ROUTE_SUMMARY_H__
+
+#include <cartotype_compact_graph.h>
+#include <cartotype_navigation.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A lightweight route result holding only the arcs of the route and its totals, for uses such as
+estimating arrival times, which do not need route segments, road names or turn instructions.
+
+The full CRoute, with its segments and everything needed for instructions, is created only
+when it is first asked for, by a function supplied when the summary is created.
+A summary may be used by only one thread at a time.
+*/
+class CRouteSummary
+    {
+    public:
+    /** A function to create the full route from the arcs of a route. */
+    using TRouteFactory = std::function<std::unique_ptr<CRoute>(const std::vector<uint32>& aArcPath)>;
+
+    CRouteSummary() { }
+    CRouteSummary(std::vector<uint32>&& aArcPath,double aDistance,double aTime,uint32 aCost,TRouteFactory aRouteFactory = nullptr):
+        iArcPath(std::move(aArcPath)),
+        iDistance(aDistance),
+        iTime(aTime),
+        iCost(aCost),
+        iRouteFactory(aRouteFactory)
+        {
+        }
+
+    /** Return the arcs of the route, in order. */
+    const std::vector<uint32>& ArcPath() const { return iArcPath; }
+    /** Return the distance of the route in metres. */
+    double Distance() const { return iDistance; }
+    /** Return the estimated time taken to traverse the route in seconds. */
+    double Time() const { return iTime; }
+    /** Return the cost of the route as used by the router. */
+    uint32 Cost() const { return iCost; }
+    /** Return true if the full route has been created. */
+    bool RouteCreated() const { return iRoute != nullptr; }
+
+    /**
+    Return the full route, creating it if necessary. Return null if it cannot be created,
+    because no route factory was supplied or the factory failed.
+    */
+    const CRoute* Route()
+        {
+        if (!iRoute && iRouteFactory)
+            {
+            iRoute = iRouteFactory(iArcPath);
+            if (iRoute)
+                iRouteFactory = nullptr;
+            }
+        return iRoute.get();
+        }
+
+    /** Return the full route, creating it if necessary, and transfer ownership of it to the caller. */
+    std::unique_ptr<CRoute> TakeRoute()
+        {
+        Route();
+        return std::move(iRoute);
+        }
+
+    private:
+    std::vector<uint32> iArcPath;
+    double iDistance = 0;
+    double iTime = 0;
+    uint32 iCost = 0;
+    TRouteFactory iRouteFactory;
+    std::unique_ptr<CRoute> iRoute;
+    };
+
+/**
+Find the route from aStart to aEnd using aRouter and aArcCost, and create a summary of it in aSummary,
+with aRouteFactory, which may be null, as the function used to create the full route when it is needed.
+Return KErrorNoRoute if there is no route.
+*/
+inline TResult CreateRouteSummary(CRouteSummary& aSummary,CCompactRouter& aRouter,uint32 aStart,uint32 aEnd,const TCompactArcCost& aArcCost,
+                                  CRouteSummary::TRouteFactory aRouteFactory = nullptr)
+    {
+    std::vector<uint32> arc_path;
+    uint32 cost = 0;
+    TResult error = aRouter.Route(aStart,aEnd,aArcCost,cost,&arc_path);
+    if (error)
+        return error;
+    const CCompactRouterGraph& graph = aRouter.Graph();
+    double distance = 0, time = 0;
+    for (auto arc : arc_path)
+        {
+        uint32 flags = graph.ArcFlags(arc);
+        float length = graph.ArcLength(arc);
+        distance += length;
+        time += aArcCost.Time(flags,length);
+        }
+    aSummary = CRouteSummary(std::move(arc_path),distance,time,cost,aRouteFactory);
+    return KErrorNone;
+    }
+
+}
+
+#endif
@@ -0,0 +1,615 @@
+/*
+CARTOTYPE_RTREE.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_RTREE_H__
+#define CARTOTYPE_RTREE_H__
+
+#include <cartotype_base.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A dynamic R-tree spatial index storing values of type T, each with a bounding rectangle.
+It is intended for writable data that changes frequently, like the objects in the memory map database.
+
+T must be default-constructible, copyable and hashable using std::hash, and all values in the
+tree must be different. Map object identifiers are the natural choice.
+
+Bounding rectangles are treated as closed: a rectangle intersects another if they share
+any point, including points on their edges. Thus a point may be stored as a rectangle with both corners at the point.
+
+The tree can be built incrementally by Insert, or all at once by Load, which creates a packed Hilbert R-tree.
+Move changes the bounds of a value in place, without restructuring the tree,
+if the new bounds lie within the bounds of the value's leaf node; this makes it cheap to update moving points.
+*/
+template<class T,size_t aMaxEntries = 16> class CRTree
+    {
+    public:
+    CRTree() { }
+    ~CRTree() { DeleteAll(iRoot); }
+    CRTree(const CRTree&) = delete;
+    CRTree& operator=(const CRTree&) = delete;
+
+    /** Return the number of values in the tree. */
+    size_t Count() const { return iLeaf.size(); }
+
+    /** Delete all the values. */
+    void Clear()
+        {
+        DeleteAll(iRoot);
+        iRoot = nullptr;
+        iLeaf.clear();
+        }
+
+    /** Return the bounds of all the values in the tree, or an empty rectangle if the tree is empty. */
+    TRect Bounds() const { return iRoot ? iRoot->iBounds : TRect(); }
+
+    /** Return true if aValue is in the tree. */
+    bool Contains(const T& aValue) const { return iLeaf.find(aValue) != iLeaf.end(); }
+
+    /** Insert a value, which must not already be in the tree, with the bounds aBounds. */
+    void Insert(const T& aValue,const TRect& aBounds)
+        {
+        assert(!Contains(aValue));
+        if (!iRoot)
+            iRoot = new TNode(true);
+        TNode* leaf = ChooseLeaf(aBounds);
+        size_t index = leaf->iCount++;
+        leaf->iEntryBounds[index] = aBounds;
+        leaf->iValue[index] = aValue;
+        iLeaf[aValue] = leaf;
+        if (leaf->iCount > aMaxEntries)
+            Split(leaf);
+        else
+            RecalculateUpwards(leaf);
+        }
+
+    /** Delete a value. Return false if it was not found. */
+    bool Delete(const T& aValue)
+        {
+        auto iter = iLeaf.find(aValue);
+        if (iter == iLeaf.end())
+            return false;
+        TNode* leaf = iter->second;
+        iLeaf.erase(iter);
+        RemoveEntry(leaf,ValueIndex(leaf,aValue));
+        Condense(leaf);
+        return true;
+        }
+
+    /**
+    Change the bounds of a value. Return false if the value was not found.
+    If the new bounds are inside the bounds of the leaf node containing the value,
+    which is usual for small movements of points, the tree is not restructured.
+    */
+    bool Move(const T& aValue,const TRect& aNewBounds)
+        {
+        auto iter = iLeaf.find(aValue);
+        if (iter == iLeaf.end())
+            return false;
+        TNode* leaf = iter->second;
+        size_t index = ValueIndex(leaf,aValue);
+        if (leaf->iBounds.Contains(aNewBounds))
+            {
+            leaf->iEntryBounds[index] = aNewBounds;
+            return true;
+            }
+        iLeaf.erase(iter);
+        RemoveEntry(leaf,index);
+        Condense(leaf);
+        Insert(aValue,aNewBounds);
+        return true;
+        }
+
+    /** Change the position of a value stored as a point. Return false if the value was not found. */
+    bool Move(const T& aValue,const TPoint& aNewPosition)
+        {
+        return Move(aValue,TRect(aNewPosition.iX,aNewPosition.iY,aNewPosition.iX,aNewPosition.iY));
+        }
+
+    /**
+    Call aFunction(const T& aValue,const TRect& aBounds) for every value with bounds intersecting aRect.
+    The function returns true to continue searching or false to stop.
+    Return false if the search was stopped by aFunction, true if it was completed.
+    */
+    template<class F> bool Find(const TRect& aRect,F aFunction) const
+        {
+        if (!iRoot)
+            return true;
+        std::vector<const TNode*> stack;
+        stack.push_back(iRoot);
+        while (!stack.empty())
+            {
+            const TNode* node = stack.back();
+            stack.pop_back();
+            for (size_t i = 0; i < node->iCount; i++)
+                {
+                if (!Overlaps(node->iEntryBounds[i],aRect))
+                    continue;
+                if (node->iLeaf)
+                    {
+                    if (!aFunction(node->iValue[i],node->iEntryBounds[i]))
+                        return false;
+                    }
+                else
+                    stack.push_back(node->iChild[i]);
+                }
+            }
+        return true;
+        }
+
+    /** Append all values with bounds intersecting aRect to aValueArray. */
+    void Find(const TRect& aRect,std::vector<T>& aValueArray) const
+        {
+        Find(aRect,[&aValueArray](const T& aValue,const TRect&) { aValueArray.push_back(aValue); return true; });
+        }
+
+    /**
+    Call aFunction(const T& aValue,const TRect& aBounds,double aDistance) for values in increasing order
+    of aDistance, the distance from aPoint to their bounds, until aFunction returns false.
+    This is used for nearest-neighbour searches: the caller measures the true distance to each value's
+    geometry and stops when aDistance exceeds the best distance found so far.
+    Return false if the search was stopped by aFunction, true if every value was visited.
+    */
+    template<class F> bool FindNearest(const TPoint& aPoint,F aFunction) const
+        {
+        if (!iRoot)
+            return true;
+
+        class TQueueEntry
+            {
+            public:
+            bool operator<(const TQueueEntry& aOther) const { return iDistance > aOther.iDistance; }
+
+            double iDistance;
+            const TNode* iNode;
+            size_t iIndex;  // the index of a value in a leaf, or SIZE_MAX for a node
+            };
+
+        std::priority_queue<TQueueEntry> queue;
+        queue.push({ Distance(aPoint,iRoot->iBounds),iRoot,SIZE_MAX });
+        while (!queue.empty())
+            {
+            TQueueEntry entry = queue.top();
+            queue.pop();
+            if (entry.iIndex != SIZE_MAX)
+                {
+                if (!aFunction(entry.iNode->iValue[entry.iIndex],entry.iNode->iEntryBounds[entry.iIndex],entry.iDistance))
+                    return false;
+                continue;
+                }
+            const TNode* node = entry.iNode;
+            for (size_t i = 0; i < node->iCount; i++)
+                {
+                double d = Distance(aPoint,node->iEntryBounds[i]);
+                if (node->iLeaf)
+                    queue.push({ d,node,i });
+                else
+                    queue.push({ d,node->iChild[i],SIZE_MAX });
+                }
+            }
+        return true;
+        }
+
+    /**
+    Replace the contents of the tree with the values in aItemArray,
+    creating a packed Hilbert R-tree, which is faster to build and to search
+    than a tree of the same values created by successive insertions.
+    */
+    void Load(std::vector<std::pair<T,TRect>> aItemArray)
+        {
+        Clear();
+        if (aItemArray.empty())
+            return;
+
+        TRect extent = aItemArray.front().second;
+        for (const auto& p : aItemArray)
+            CombineRect(extent,p.second);
+
+        std::vector<std::pair<uint64,size_t>> order(aItemArray.size());
+        for (size_t i = 0; i < aItemArray.size(); i++)
+            order[i] = std::make_pair(HilbertValue(aItemArray[i].second,extent),i);
+        std::sort(order.begin(),order.end());
+
+        std::vector<TNode*> level;
+        for (size_t i = 0; i < order.size(); i += aMaxEntries)
+            {
+            TNode* leaf = new TNode(true);
+            size_t end = std::min(i + aMaxEntries,order.size());
+            for (size_t j = i; j < end; j++)
+                {
+                const auto& item = aItemArray[order[j].second];
+                leaf->iEntryBounds[leaf->iCount] = item.second;
+                leaf->iValue[leaf->iCount++] = item.first;
+                iLeaf[item.first] = leaf;
+                }
+            RecalculateBounds(leaf);
+            level.push_back(leaf);
+            }
+
+        while (level.size() > 1)
+            {
+            std::vector<TNode*> parent_level;
+            for (size_t i = 0; i < level.size(); i += aMaxEntries)
+                {
+                TNode* parent = new TNode(false);
+                size_t end = std::min(i + aMaxEntries,level.size());
+                for (size_t j = i; j < end; j++)
+                    AppendChild(parent,level[j]);
+                RecalculateBounds(parent);
+                parent_level.push_back(parent);
+                }
+            level.swap(parent_level);
+            }
+        iRoot = level.front();
+        }
+
+    private:
+    static_assert(aMaxEntries >= 4,"an R-tree node must be able to hold at least four entries");
+    static constexpr size_t KMinEntries = aMaxEntries * 2 / 5;
+
+    class TNode
+        {
+        public:
+        explicit TNode(bool aLeaf): iLeaf(aLeaf) { }
+
+        TRect iBounds;
+        TNode* iParent = nullptr;
+        bool iLeaf;
+        size_t iCount = 0;
+        std::array<TRect,aMaxEntries + 1> iEntryBounds;
+        std::array<TNode*,aMaxEntries + 1> iChild;  // used only by internal nodes
+        std::array<T,aMaxEntries + 1> iValue;       // used only by leaf nodes
+        };
+
+    static bool Overlaps(const TRect& aA,const TRect& aB)
+        {
+        return aA.iTopLeft.iX <= aB.iBottomRight.iX && aA.iBottomRight.iX >= aB.iTopLeft.iX &&
+               aA.iTopLeft.iY <= aB.iBottomRight.iY && aA.iBottomRight.iY >= aB.iTopLeft.iY;
+        }
+
+    static double Distance(const TPoint& aPoint,const TRect& aRect)
+        {
+        double dx = 0, dy = 0;
+        if (aPoint.iX < aRect.iTopLeft.iX)
+            dx = double(aRect.iTopLeft.iX) - aPoint.iX;
+        else if (aPoint.iX > aRect.iBottomRight.iX)
+            dx = double(aPoint.iX) - aRect.iBottomRight.iX;
+        if (aPoint.iY < aRect.iTopLeft.iY)
+            dy = double(aRect.iTopLeft.iY) - aPoint.iY;
+        else if (aPoint.iY > aRect.iBottomRight.iY)
+            dy = double(aPoint.iY) - aRect.iBottomRight.iY;
+        return std::sqrt(dx * dx + dy * dy);
+        }
+
+    static void CombineRect(TRect& aRect,const TRect& aOther)
+        {
+        aRect.iTopLeft.iX = std::min(aRect.iTopLeft.iX,aOther.iTopLeft.iX);
+        aRect.iTopLeft.iY = std::min(aRect.iTopLeft.iY,aOther.iTopLeft.iY);
+        aRect.iBottomRight.iX = std::max(aRect.iBottomRight.iX,aOther.iBottomRight.iX);
+        aRect.iBottomRight.iY = std::max(aRect.iBottomRight.iY,aOther.iBottomRight.iY);
+        }
+
+    static double Area(const TRect& aRect)
+        {
+        return (double(aRect.iBottomRight.iX) - double(aRect.iTopLeft.iX)) * (double(aRect.iBottomRight.iY) - double(aRect.iTopLeft.iY));
+        }
+
+    static double Enlargement(const TRect& aRect,const TRect& aOther)
+        {
+        TRect r = aRect;
+        CombineRect(r,aOther);
+        return Area(r) - Area(aRect);
+        }
+
+    // Return the position of the center of aRect on a Hilbert curve covering aExtent with a 65536 x 65536 grid.
+    static uint64 HilbertValue(const TRect& aRect,const TRect& aExtent)
+        {
+        double w = double(aExtent.iBottomRight.iX) - double(aExtent.iTopLeft.iX);
+        double h = double(aExtent.iBottomRight.iY) - double(aExtent.iTopLeft.iY);
+        double cx = (double(aRect.iTopLeft.iX) + double(aRect.iBottomRight.iX)) / 2 - aExtent.iTopLeft.iX;
+        double cy = (double(aRect.iTopLeft.iY) + double(aRect.iBottomRight.iY)) / 2 - aExtent.iTopLeft.iY;
+        uint32 x = w > 0 ? uint32(std::min(cx / w * 65535.0,65535.0)) : 0;
+        uint32 y = h > 0 ? uint32(std::min(cy / h * 65535.0,65535.0)) : 0;
+
+        uint64 d = 0;
+        for (uint32 s = 1 << 15; s > 0; s >>= 1)
+            {
+            uint32 rx = (x & s) ? 1 : 0;
+            uint32 ry = (y & s) ? 1 : 0;
+            d += uint64(s) * uint64(s) * ((3 * rx) ^ ry);
+            if (ry == 0)
+                {
+                if (rx == 1)
+                    {
+                    x = 65535 - x;
+                    y = 65535 - y;
+                    }
+                std::swap(x,y);
+                }
+            }
+        return d;
+        }
+
+    static void DeleteAll(TNode* aNode)
+        {
+        if (!aNode)
+            return;
+        if (!aNode->iLeaf)
+            {
+            for (size_t i = 0; i < aNode->iCount; i++)
+                DeleteAll(aNode->iChild[i]);
+            }
+        delete aNode;
+        }
+
+    static void RecalculateBounds(TNode* aNode)
+        {
+        if (aNode->iCount == 0)
+            {
+            aNode->iBounds = TRect();
+            return;
+            }
+        aNode->iBounds = aNode->iEntryBounds[0];
+        for (size_t i = 1; i < aNode->iCount; i++)
+            CombineRect(aNode->iBounds,aNode->iEntryBounds[i]);
+        }
+
+    static size_t ChildIndex(const TNode* aParent,const TNode* aChild)
+        {
+        for (size_t i = 0; i < aParent->iCount; i++)
+            if (aParent->iChild[i] == aChild)
+                return i;
+        assert(false);
+        return 0;
+        }
+
+    static size_t ValueIndex(const TNode* aLeaf,const T& aValue)
+        {
+        for (size_t i = 0; i < aLeaf->iCount; i++)
+            if (aLeaf->iValue[i] == aValue)
+                return i;
+        assert(false);
+        return 0;
+        }
+
+    static void AppendChild(TNode* aParent,TNode* aChild)
+        {
+        size_t index = aParent->iCount++;
+        aParent->iEntryBounds[index] = aChild->iBounds;
+        aParent->iChild[index] = aChild;
+        aChild->iParent = aParent;
+        }
+
+    static void RemoveEntry(TNode* aNode,size_t aIndex)
+        {
+        size_t last = --aNode->iCount;
+        if (aIndex != last)
+            {
+            aNode->iEntryBounds[aIndex] = aNode->iEntryBounds[last];
+            if (aNode->iLeaf)
+                aNode->iValue[aIndex] = aNode->iValue[last];
+            else
+                aNode->iChild[aIndex] = aNode->iChild[last];
+            }
+        }
+
+    // Recalculate the bounds of a node and all its ancestors.
+    static void RecalculateUpwards(TNode* aNode)
+        {
+        while (aNode)
+            {
+            RecalculateBounds(aNode);
+            TNode* parent = aNode->iParent;
+            if (parent)
+                parent->iEntryBounds[ChildIndex(parent,aNode)] = aNode->iBounds;
+            aNode = parent;
+            }
+        }
+
+    TNode* ChooseLeaf(const TRect& aBounds) const
+        {
+        TNode* node = iRoot;
+        while (!node->iLeaf)
+            {
+            size_t best = 0;
+            double best_enlargement = 0;
+            double best_area = 0;
+            for (size_t i = 0; i < node->iCount; i++)
+                {
+                double enlargement = Enlargement(node->iEntryBounds[i],aBounds);
+                double area = Area(node->iEntryBounds[i]);
+                if (i == 0 || enlargement < best_enlargement || (enlargement == best_enlargement && area < best_area))
+                    {
+                    best = i;
+                    best_enlargement = enlargement;
+                    best_area = area;
+                    }
+                }
+            node = node->iChild[best];
+            }
+        return node;
+        }
+
+    // Split an overflowing node using Guttman's quadratic method.
+    void Split(TNode* aNode)
+        {
+        const size_t n = aNode->iCount;
+        TNode old_node = *aNode;
+
+        // Pick the two seeds that would waste the most area if put in the same node.
+        size_t seed[2] = { 0, 1 };
+        double worst_waste = -1;
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = i + 1; j < n; j++)
+                {
+                TRect r = old_node.iEntryBounds[i];
+                CombineRect(r,old_node.iEntryBounds[j]);
+                double waste = Area(r) - Area(old_node.iEntryBounds[i]) - Area(old_node.iEntryBounds[j]);
+                if (waste > worst_waste)
+                    {
+                    worst_waste = waste;
+                    seed[0] = i;
+                    seed[1] = j;
+                    }
+                }
+
+        TNode* sibling = new TNode(aNode->iLeaf);
+        TNode* group[2] = { aNode, sibling };
+        aNode->iCount = 0;
+        std::array<bool,aMaxEntries + 1> assigned = { };
+        for (size_t g = 0; g < 2; g++)
+            {
+            AppendEntry(group[g],old_node,seed[g]);
+            group[g]->iBounds = old_node.iEntryBounds[seed[g]];
+            assigned[seed[g]] = true;
+            }
+
+        size_t remaining = n - 2;
+        while (remaining)
+            {
+            // If one group needs all the remaining entries to reach the minimum, give them to it.
+            size_t forced_group = 2;
+            for (size_t g = 0; g < 2; g++)
+                if (group[g]->iCount + remaining <= KMinEntries)
+                    forced_group = g;
+
+            // Otherwise pick the entry with the greatest preference for one group.
+            size_t next = 0;
+            size_t next_group = 0;
+            double greatest_difference = -1;
+            for (size_t i = 0; i < n; i++)
+                {
+                if (assigned[i])
+                    continue;
+                double d0 = Enlargement(group[0]->iBounds,old_node.iEntryBounds[i]);
+                double d1 = Enlargement(group[1]->iBounds,old_node.iEntryBounds[i]);
+                double difference = std::abs(d0 - d1);
+                if (difference > greatest_difference)
+                    {
+                    greatest_difference = difference;
+                    next = i;
+                    if (d0 != d1)
+                        next_group = d0 < d1 ? 0 : 1;
+                    else
+                        next_group = group[0]->iCount <= group[1]->iCount ? 0 : 1;
+                    }
+                if (forced_group != 2)
+                    break;
+                }
+            if (forced_group != 2)
+                next_group = forced_group;
+
+            AppendEntry(group[next_group],old_node,next);
+            CombineRect(group[next_group]->iBounds,old_node.iEntryBounds[next]);
+            assigned[next] = true;
+            remaining--;
+            }
+
+        if (aNode == iRoot)
+            {
+            iRoot = new TNode(false);
+            AppendChild(iRoot,aNode);
+            AppendChild(iRoot,sibling);
+            RecalculateBounds(iRoot);
+            return;
+            }
+
+        TNode* parent = aNode->iParent;
+        parent->iEntryBounds[ChildIndex(parent,aNode)] = aNode->iBounds;
+        AppendChild(parent,sibling);
+        if (parent->iCount > aMaxEntries)
+            Split(parent);
+        else
+            RecalculateUpwards(parent);
+        }
+
+    void AppendEntry(TNode* aNode,const TNode& aSource,size_t aIndex)
+        {
+        size_t index = aNode->iCount++;
+        aNode->iEntryBounds[index] = aSource.iEntryBounds[aIndex];
+        if (aNode->iLeaf)
+            {
+            aNode->iValue[index] = aSource.iValue[aIndex];
+            iLeaf[aSource.iValue[aIndex]] = aNode;
+            }
+        else
+            {
+            aNode->iChild[index] = aSource.iChild[aIndex];
+            aSource.iChild[aIndex]->iParent = aNode;
+            }
+        }
+
+    // Remove the values in a subtree from the leaf index, storing them in aOrphanArray for reinsertion, and delete the subtree.
+    void Orphan(TNode* aNode,std::vector<std::pair<T,TRect>>& aOrphanArray)
+        {
+        for (size_t i = 0; i < aNode->iCount; i++)
+            {
+            if (aNode->iLeaf)
+                {
+                aOrphanArray.push_back(std::make_pair(aNode->iValue[i],aNode->iEntryBounds[i]));
+                iLeaf.erase(aNode->iValue[i]);
+                }
+            else
+                Orphan(aNode->iChild[i],aOrphanArray);
+            }
+        delete aNode;
+        }
+
+    // Remove underfull nodes on the path from aNode to the root, reinsert their values, and tighten the bounds.
+    void Condense(TNode* aNode)
+        {
+        std::vector<std::pair<T,TRect>> orphan_array;
+        TNode* node = aNode;
+        while (node->iParent)
+            {
+            TNode* parent = node->iParent;
+            size_t index = ChildIndex(parent,node);
+            if (node->iCount < KMinEntries)
+                {
+                RemoveEntry(parent,index);
+                Orphan(node,orphan_array);
+                }
+            else
+                {
+                RecalculateBounds(node);
+                parent->iEntryBounds[index] = node->iBounds;
+                }
+            node = parent;
+            }
+        RecalculateBounds(iRoot);
+
+        while (!iRoot->iLeaf && iRoot->iCount == 1)
+            {
+            TNode* child = iRoot->iChild[0];
+            child->iParent = nullptr;
+            delete iRoot;
+            iRoot = child;
+            }
+        if (iRoot->iCount == 0)
+            {
+            delete iRoot;
+            iRoot = nullptr;
+            }
+
+        for (const auto& p : orphan_array)
+            Insert(p.first,p.second);
+        }
+
+    TNode* iRoot = nullptr;
+    std::unordered_map<T,TNode*> iLeaf; // the leaf node containing each value
+    };
+
+}
+
+#endif
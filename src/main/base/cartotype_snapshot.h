@@ -0,0 +1,109 @@
+/*
+CARTOTYPE_SNAPSHOT.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_SNAPSHOT_H__
+#define CARTOTYPE_SNAPSHOT_H__
+
+#include <cartotype_types.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace CartoType
+{
+
+/**
+An immutable version of some data of type T, with the generation number
+it was given when it was published by a CSnapshotPublisher.
+*/
+template<class T> class CSnapshot
+    {
+    public:
+    CSnapshot(T&& aData,uint32 aGeneration): iData(std::move(aData)), iGeneration(aGeneration) { }
+
+    /** The data, which never changes once published. */
+    const T iData;
+    /** The generation number, which is greater for later snapshots. */
+    const uint32 iGeneration;
+    };
+
+/**
+CSnapshotPublisher shares data of type T between writers and readers on different threads
+without making readers wait while a writer creates a new version.
+
+A writer creates a new version of the data, either from scratch using Publish, or by
+changing a copy of the current version using Update, and publishes it atomically. Readers
+call Pin to get the current snapshot, and can use it for as long as they hold the
+returned pointer, whatever changes are published in the meantime. Old snapshots are
+destroyed when the last reader releases them.
+
+Writers are serialized by a mutex, but readers never lock it, and a writer holds it only
+while creating the new version, so readers such as tile drawing threads always see a
+complete, consistent version of the data.
+
+Pin and publication use the standard atomic operations on shared_ptr, which are not lock-free
+in common implementations: they take a short internal lock while the pointer and its reference count
+are copied. A reader can therefore be delayed briefly by another thread copying or replacing the pointer,
+but never while a new version is being created.
+*/
+template<class T> class CSnapshotPublisher
+    {
+    public:
+    /** Create a publisher with an initial snapshot of generation zero containing default-constructed data. */
+    CSnapshotPublisher():
+        iCurrent(std::make_shared<const CSnapshot<T>>(T(),0))
+        {
+        }
+
+    CSnapshotPublisher(const CSnapshotPublisher&) = delete;
+    CSnapshotPublisher& operator=(const CSnapshotPublisher&) = delete;
+
+    /** Return the current snapshot. The caller may use it for as long as it keeps the pointer. */
+    std::shared_ptr<const CSnapshot<T>> Pin() const
+        {
+        return std::atomic_load(&iCurrent);
+        }
+
+    /** Return the generation of the current snapshot. */
+    uint32 Generation() const
+        {
+        return Pin()->iGeneration;
+        }
+
+    /** Publish aData as the new current snapshot and return its generation number. */
+    uint32 Publish(T aData)
+        {
+        std::lock_guard<std::mutex> lock(iWriterMutex);
+        return PublishHelper(std::move(aData));
+        }
+
+    /**
+    Copy the current data, change the copy by calling aFunction(T&), and publish it
+    as the new current snapshot. Return the generation number of the new snapshot.
+    */
+    template<class F> uint32 Update(F aFunction)
+        {
+        std::lock_guard<std::mutex> lock(iWriterMutex);
+        T data(Pin()->iData);
+        aFunction(data);
+        return PublishHelper(std::move(data));
+        }
+
+    private:
+    uint32 PublishHelper(T&& aData)
+        {
+        uint32 generation = std::atomic_load(&iCurrent)->iGeneration + 1;
+        std::atomic_store(&iCurrent,std::shared_ptr<const CSnapshot<T>>(std::make_shared<const CSnapshot<T>>(std::move(aData),generation)));
+        return generation;
+        }
+
+    std::shared_ptr<const CSnapshot<T>> iCurrent;
+    std::mutex iWriterMutex;
+    };
+
+}
+
+#endif
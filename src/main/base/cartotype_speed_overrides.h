@@ -0,0 +1,221 @@
+/*
+CARTOTYPE_SPEED_OVERRIDES.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_SPEED_OVERRIDES_H__
+#define CARTOTYPE_SPEED_OVERRIDES_H__
+
+#include <cartotype_snapshot.h>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+An immutable table of speed overrides indexed by arc id, as used by routers in their cost functions.
+Tables are obtained from CArcSpeedOverrides::Pin.
+
+Speeds are stored in eighths of a kilometre per hour in pages of KPageSize arcs, which are found through
+blocks of KBlockSize page pointers. Pages and blocks with no overrides take no space, and a new version of the table
+shares all the pages and blocks not changed by an update with the previous version.
+*/
+class CArcSpeedTable
+    {
+    public:
+    /** The number of arcs in a page. */
+    static constexpr size_t KPageSize = 1024;
+    /** The number of pages in a block. */
+    static constexpr size_t KBlockSize = 1024;
+    /** The stored value meaning that an arc has no override. */
+    static constexpr uint16 KNoOverride = 0xFFFF;
+    /** The maximum speed that can be stored, in kilometres per hour. */
+    static constexpr double KMaxSpeed = (KNoOverride - 1) / 8.0;
+
+    /** Return true if arc aArc has a speed override, and if so put the speed in kilometres per hour in aSpeed. A speed of zero means the arc is closed. */
+    bool GetSpeed(uint32 aArc,double& aSpeed) const
+        {
+        uint16 value = Value(aArc);
+        if (value == KNoOverride)
+            return false;
+        aSpeed = value / 8.0;
+        return true;
+        }
+
+    /**
+    Adjust the cost of arc aArc, which was calculated for a speed of aBaseSpeed in kilometres per hour, for its override if any,
+    assuming that the cost is proportional to the travel time. Return UINT32_MAX if the arc is closed.
+    */
+    uint32 AdjustCost(uint32 aArc,uint32 aCost,double aBaseSpeed) const
+        {
+        uint16 value = Value(aArc);
+        if (value == KNoOverride)
+            return aCost;
+        if (value == 0)
+            return UINT32_MAX;
+        double cost = aCost * aBaseSpeed * 8.0 / value;
+        return cost >= UINT32_MAX ? UINT32_MAX : uint32(cost);
+        }
+
+    /** Return the number of arcs with overrides. */
+    size_t Count() const { return iCount; }
+
+    private:
+    friend class CArcSpeedOverrides;
+
+    class TPage
+        {
+        public:
+        TPage()
+            {
+            for (auto& v : iValue)
+                v = KNoOverride;
+            }
+
+        std::array<uint16,KPageSize> iValue;
+        size_t iCount = 0;
+        };
+
+    class TBlock
+        {
+        public:
+        std::array<std::shared_ptr<const TPage>,KBlockSize> iPage;
+        size_t iPageCount = 0;
+        };
+
+    uint16 Value(uint32 aArc) const
+        {
+        size_t page = aArc / KPageSize;
+        size_t block = page / KBlockSize;
+        if (block >= iBlock.size() || !iBlock[block])
+            return KNoOverride;
+        const auto& p = iBlock[block]->iPage[page % KBlockSize];
+        if (!p)
+            return KNoOverride;
+        return p->iValue[aArc % KPageSize];
+        }
+
+    // There is at most one block for every million arcs, so copying this vector when a new version is made is cheap.
+    std::vector<std::shared_ptr<const TBlock>> iBlock;
+    size_t iCount = 0;
+    };
+
+/**
+A thread-safe source of speed overrides for arcs, such as those created from live traffic information.
+
+Updates are applied in batches, each of which is published atomically as a new CArcSpeedTable, so route
+queries are never paused: a query calls Pin once at the start and uses the same table throughout,
+whatever updates happen meanwhile. A batch copies only the pages and blocks it changes, and the
+vector of block pointers, which has one entry for every KPageSize * KBlockSize arcs; so the cost of an
+update is proportional to the number of pages updated, not the number of pages in the map.
+*/
+class CArcSpeedOverrides
+    {
+    public:
+    /** An update to the speed of a single arc. */
+    class TUpdate
+        {
+        public:
+        TUpdate() { }
+        TUpdate(uint32 aArc,double aSpeed): iArc(aArc), iSpeed(aSpeed) { }
+
+        /** The arc id. */
+        uint32 iArc = 0;
+        /** The speed in kilometres per hour; zero closes the arc, and a negative speed removes any override. Positive speeds below 1/8 km/h are stored as 1/8 km/h. */
+        double iSpeed = -1;
+        };
+
+    /** Return the current table, which the caller can use for as long as it keeps the pointer. */
+    std::shared_ptr<const CSnapshot<CArcSpeedTable>> Pin() const { return iPublisher.Pin(); }
+
+    /** Return the generation of the current table, which increases every time a batch is applied. */
+    uint32 Generation() const { return iPublisher.Generation(); }
+
+    /**
+    Apply aCount updates as a single batch and return the generation of the new table.
+    If there is more than one update for the same arc, the last one is used.
+    */
+    uint32 Apply(const TUpdate* aUpdate,size_t aCount)
+        {
+        std::vector<TUpdate> update(aUpdate,aUpdate + aCount);
+        std::stable_sort(update.begin(),update.end(),[](const TUpdate& aA,const TUpdate& aB) { return aA.iArc < aB.iArc; });
+
+        return iPublisher.Update([&update](CArcSpeedTable& aTable)
+            {
+            const size_t arcs_per_block = CArcSpeedTable::KPageSize * CArcSpeedTable::KBlockSize;
+            size_t i = 0;
+            while (i < update.size())
+                {
+                // Copy each block once, and each page once, and apply all their updates.
+                size_t block_index = update[i].iArc / arcs_per_block;
+                if (block_index >= aTable.iBlock.size())
+                    aTable.iBlock.resize(block_index + 1);
+                const auto& old_block = aTable.iBlock[block_index];
+                auto block = old_block ? std::make_shared<CArcSpeedTable::TBlock>(*old_block) : std::make_shared<CArcSpeedTable::TBlock>();
+                while (i < update.size() && update[i].iArc / arcs_per_block == block_index)
+                    {
+                    size_t page_number = update[i].iArc / CArcSpeedTable::KPageSize;
+                    size_t page_index = page_number % CArcSpeedTable::KBlockSize;
+                    const auto& old_page = block->iPage[page_index];
+                    auto page = old_page ? std::make_shared<CArcSpeedTable::TPage>(*old_page) : std::make_shared<CArcSpeedTable::TPage>();
+                    aTable.iCount -= page->iCount;
+                    for (; i < update.size() && update[i].iArc / CArcSpeedTable::KPageSize == page_number; i++)
+                        {
+                        uint16& value = page->iValue[update[i].iArc % CArcSpeedTable::KPageSize];
+                        uint16 new_value = CArcSpeedTable::KNoOverride;
+                        double speed = update[i].iSpeed;
+                        if (speed >= 0)
+                            {
+                            new_value = uint16((speed < CArcSpeedTable::KMaxSpeed ? speed : CArcSpeedTable::KMaxSpeed) * 8 + 0.5);
+                            // Only an explicit zero closes an arc; store the smallest non-zero speed for very low speeds.
+                            if (new_value == 0 && speed > 0)
+                                new_value = 1;
+                            }
+                        if (value == CArcSpeedTable::KNoOverride && new_value != CArcSpeedTable::KNoOverride)
+                            page->iCount++;
+                        else if (value != CArcSpeedTable::KNoOverride && new_value == CArcSpeedTable::KNoOverride)
+                            page->iCount--;
+                        value = new_value;
+                        }
+                    aTable.iCount += page->iCount;
+                    if (old_page)
+                        block->iPageCount--;
+                    if (page->iCount)
+                        {
+                        block->iPage[page_index] = page;
+                        block->iPageCount++;
+                        }
+                    else
+                        block->iPage[page_index] = nullptr;
+                    }
+                if (block->iPageCount)
+                    aTable.iBlock[block_index] = block;
+                else
+                    aTable.iBlock[block_index] = nullptr;
+                }
+            });
+        }
+
+    /** Apply a batch of updates. */
+    uint32 Apply(const std::vector<TUpdate>& aUpdate)
+        {
+        return Apply(aUpdate.data(),aUpdate.size());
+        }
+
+    /** Remove all overrides and return the generation of the new, empty table. */
+    uint32 Clear()
+        {
+        return iPublisher.Publish(CArcSpeedTable());
+        }
+
+    private:
+    CSnapshotPublisher<CArcSpeedTable> iPublisher;
+    };
+
+}
+
+#endif
@@ -0,0 +1,282 @@
+/*
+CARTOTYPE_SPEED_PROFILE.H
+Copyright (C) 2017 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_SPEED_PROFILE_H__
+#define CARTOTYPE_SPEED_PROFILE_H__
+
+#include <cartotype_compact_graph.h>
+#include <cartotype_mapped_file.h>
+#include <cartotype_stream.h>
+#include <cmath>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+Historic speed profiles for the arcs of a CCompactRouterGraph, giving the usual speed on each arc at each time of the week.
+
+A profile gives a speed for each quarter of an hour of the week, starting at midnight at the start of Monday, local time,
+as a percentage of the speed used by the route profile; for example, 50 means that traffic moves at half that speed.
+Profiles are stored once in a shared table, and each arc stores only the 16-bit index of its profile, so they take two bytes
+for each arc as well as 672 bytes for each distinct profile. Index 0 means that the arc has no profile and its speed is constant.
+
+Arcs are numbered as in the graph. If CCompactRouterGraph::Build has reordered the arcs, use the arc order it returns to
+number the arcs when calling SetArcProfile.
+*/
+class CCompactSpeedProfiles
+    {
+    public:
+    /** The number of time slots in a week. */
+    static constexpr uint32 KSlotsPerWeek = 7 * 24 * 4;
+    /** The length of a time slot in milliseconds. */
+    static constexpr uint32 KSlotMilliseconds = 15 * 60 * 1000;
+    /** The length of a week in milliseconds. */
+    static constexpr uint32 KWeekMilliseconds = KSlotsPerWeek * KSlotMilliseconds;
+
+    /** Create an empty set of profiles for aArcCount arcs, none of which has a profile. */
+    explicit CCompactSpeedProfiles(uint32 aArcCount = 0):
+        iArcProfile(aArcCount)
+        {
+        }
+
+    /**
+    Add a profile given as KSlotsPerWeek speed percentages, none of which may be zero, and put its index in aIndex.
+    Return KErrorInvalidArgument if the profile is invalid or there are too many profiles.
+    */
+    TResult AddProfile(const std::vector<uint8>& aSpeedPercent,uint32& aIndex)
+        {
+        if (aSpeedPercent.size() != KSlotsPerWeek || ProfileCount() >= KMaxProfiles)
+            return KErrorInvalidArgument;
+        for (auto p : aSpeedPercent)
+            if (p == 0)
+                return KErrorInvalidArgument;
+        iSpeedPercent.insert(iSpeedPercent.end(),aSpeedPercent.begin(),aSpeedPercent.end());
+        for (auto p : aSpeedPercent)
+            if (p > iMaxSpeedPercent)
+                iMaxSpeedPercent = p;
+        aIndex = ProfileCount();
+        return KErrorNone;
+        }
+
+    /** Set the profile of arc aArc to aProfile, which is 0 for none, or an index returned by AddProfile. */
+    TResult SetArcProfile(uint32 aArc,uint32 aProfile)
+        {
+        if (aArc >= ArcCount() || aProfile > ProfileCount())
+            return KErrorInvalidArgument;
+        iArcProfile[aArc] = uint16(aProfile);
+        return KErrorNone;
+        }
+
+    /** Return the number of arcs. */
+    uint32 ArcCount() const { return uint32(iArcProfile.size()); }
+    /** Return the number of profiles, not counting profile 0, which means a constant speed. */
+    uint32 ProfileCount() const { return uint32(iSpeedPercent.size() / KSlotsPerWeek); }
+    /** Return the profile of an arc. */
+    uint32 ArcProfile(uint32 aArc) const { return iArcProfile[aArc]; }
+    /** Return the speed percentage of a profile in a time slot. */
+    uint32 SpeedPercent(uint32 aProfile,uint32 aSlot) const { return aProfile ? iSpeedPercent[size_t(aProfile - 1) * KSlotsPerWeek + aSlot] : 100; }
+    /** Return the greatest speed percentage in any profile, or 100 if it is less than that. */
+    uint32 MaxSpeedPercent() const { return iMaxSpeedPercent; }
+    /** Return the number of bytes used by the profiles. */
+    size_t MemoryUsed() const { return iSpeedPercent.size() + iArcProfile.size() * sizeof(uint16); }
+
+    /**
+    Return the time in milliseconds taken to traverse an arc with profile aProfile, entering it at aWeekTime
+    milliseconds after the start of the week, if it takes aTime milliseconds at the profile's normal speed.
+    The speed changes at the end of each time slot, so entering an arc later never means leaving it earlier.
+    */
+    uint32 TravelTime(uint32 aProfile,uint32 aWeekTime,uint32 aTime) const
+        {
+        if (!aProfile)
+            return aTime;
+        const uint8* speed = iSpeedPercent.data() + size_t(aProfile - 1) * KSlotsPerWeek;
+        const uint32 week_milliseconds = KWeekMilliseconds;
+        const uint32 slot_milliseconds = KSlotMilliseconds;
+        uint32 slot = (aWeekTime % week_milliseconds) / slot_milliseconds;
+        uint64 time_in_slot = aWeekTime % slot_milliseconds;
+
+        // The work remaining is measured in percent-milliseconds: a millisecond at 100 percent does 100 units.
+        uint64 remaining = uint64(aTime) * 100;
+        uint64 travel_time = 0;
+        for (;;)
+            {
+            uint64 percent = speed[slot];
+            uint64 slot_time = slot_milliseconds - time_in_slot;
+            if (slot_time * percent >= remaining)
+                {
+                travel_time += (remaining + percent - 1) / percent;
+                break;
+                }
+            remaining -= slot_time * percent;
+            travel_time += slot_time;
+            time_in_slot = 0;
+            if (++slot == KSlotsPerWeek)
+                slot = 0;
+            }
+        return travel_time < UINT32_MAX ? uint32(travel_time) : UINT32_MAX - 1;
+        }
+
+    /** Write the profiles to a stream. */
+    TResult Write(MOutputStream& aOutputStream) const
+        {
+        TDataOutputStream output(aOutputStream);
+        TResult error = output.WriteUint32(KFileSignature);
+        if (!error)
+            error = output.WriteUint32(KFileVersion);
+        if (!error)
+            error = output.WriteUint32(KSlotsPerWeek);
+        if (!error)
+            error = output.WriteUint32(ProfileCount());
+        if (!error)
+            error = output.WriteUint32(ArcCount());
+        if (!error && !iSpeedPercent.empty())
+            error = output.WriteBytes(iSpeedPercent.data(),iSpeedPercent.size());
+        for (size_t i = 0; !error && i < iArcProfile.size(); i++)
+            error = output.WriteUint16(iArcProfile[i]);
+        return error;
+        }
+
+    /** Read profiles written by Write. */
+    TResult Read(MInputStream& aInputStream)
+        {
+        TDataInputStream input(aInputStream);
+        TResult error = 0;
+        uint32 signature = input.ReadUint32(error);
+        if (!error && signature != KFileSignature)
+            return KErrorUnknownDataFormat;
+        uint32 version = 0;
+        if (!error)
+            version = input.ReadUint32(error);
+        if (!error && version != KFileVersion)
+            return KErrorUnknownVersion;
+        uint32 slots = 0, profile_count = 0, arc_count = 0;
+        if (!error)
+            slots = input.ReadUint32(error);
+        if (!error)
+            profile_count = input.ReadUint32(error);
+        if (!error)
+            arc_count = input.ReadUint32(error);
+        if (!error && (slots != KSlotsPerWeek || profile_count > KMaxProfiles))
+            return KErrorCorrupt;
+        std::vector<uint8> speed_percent;
+        if (!error)
+            speed_percent.resize(size_t(profile_count) * KSlotsPerWeek);
+        uint32 max_speed_percent = 100;
+        for (size_t i = 0; !error && i < speed_percent.size(); i++)
+            {
+            speed_percent[i] = input.ReadUint8(error);
+            if (!error && speed_percent[i] == 0)
+                error = KErrorCorrupt;
+            if (speed_percent[i] > max_speed_percent)
+                max_speed_percent = speed_percent[i];
+            }
+        std::vector<uint16> arc_profile;
+        if (!error)
+            arc_profile.resize(arc_count);
+        for (size_t i = 0; !error && i < arc_profile.size(); i++)
+            {
+            arc_profile[i] = input.ReadUint16(error);
+            if (!error && arc_profile[i] > profile_count)
+                error = KErrorCorrupt;
+            }
+        if (error)
+            return error;
+        iSpeedPercent.swap(speed_percent);
+        iArcProfile.swap(arc_profile);
+        iMaxSpeedPercent = max_speed_percent;
+        return KErrorNone;
+        }
+
+    /** Read profiles written by Write from a file. */
+    TResult Read(const char* aFileName)
+        {
+        TResult error = KErrorNone;
+        std::unique_ptr<CMappedFile> file = CMappedFile::New(error,aFileName);
+        if (error)
+            return error;
+        TMemoryInputStream input(file->Data(),file->Size());
+        return Read(input);
+        }
+
+    private:
+    static constexpr uint32 KFileSignature = 0x50535443; // 'CTSP'
+    static constexpr uint32 KFileVersion = 1;
+    static constexpr uint32 KMaxProfiles = 0xFFFF;
+
+    std::vector<uint8> iSpeedPercent;   // KSlotsPerWeek speed percentages for each profile
+    std::vector<uint16> iArcProfile;    // the profile of each arc, or 0 if none
+    uint32 iMaxSpeedPercent = 100;
+    };
+
+/** A lower bound for time-dependent routes, made from a lower bound for routes at normal speeds. */
+template<class TBound> class TCompactTimeDependentBound
+    {
+    public:
+    TCompactTimeDependentBound(const TBound& aBound,uint32 aMaxSpeedPercent):
+        iBound(aBound),
+        iScale(100.0 / aMaxSpeedPercent)
+        {
+        }
+    uint32 LowerBound(uint32 aNode,uint32 aTarget) const { return uint32(iBound.LowerBound(aNode,aTarget) * iScale); }
+    bool ValidFor(uint32 aNodeCount) const { return iBound.ValidFor(aNodeCount); }
+
+    private:
+    const TBound& iBound;
+    double iScale;
+    };
+
+/**
+Find the fastest route from aStart to aEnd leaving at aDepartureTime, using the costs in aArcCost adjusted by the speed profiles
+aSpeedProfiles, and put the travel time in milliseconds in aTime, and, if aArcPath is non-null, the arcs of the route in aArcPath.
+aDepartureTime is in seconds after midnight at the start of Monday, local time; later times are taken modulo a week.
+Bonuses and penalties in the route profile are treated as part of the travel time, as they are for routes without speed profiles.
+aBound must be a lower bound for route costs using aArcCost without speed profiles, such as one made by CCompactLandmarkCosts.
+
+Return KErrorNoRoute if there is no route, or KErrorInvalidArgument if aArcCost is for shortest routes, which are not
+affected by speed profiles and have costs that are not times, if aDepartureTime is not finite, or if the speed profiles
+are not for the router's graph.
+This function is thread-safe.
+*/
+template<class TBound> TResult TimeDependentRoute(CCompactRouter& aRouter,uint32 aStart,uint32 aEnd,double aDepartureTime,
+                                                  const TCompactArcCost& aArcCost,const CCompactSpeedProfiles& aSpeedProfiles,const TBound& aBound,
+                                                  uint32& aTime,std::vector<uint32>* aArcPath = nullptr)
+    {
+    const CCompactRouterGraph& graph = aRouter.Graph();
+    if (aSpeedProfiles.ArcCount() != graph.ArcCount() || aArcCost.Shortest() || !std::isfinite(aDepartureTime))
+        return KErrorInvalidArgument;
+    CCompactSearchStatePool::TLease state = aRouter.SearchStatePool().Acquire();
+
+    const double week_seconds = CCompactSpeedProfiles::KWeekMilliseconds / 1000.0;
+    double departure_time = std::fmod(aDepartureTime,week_seconds);
+    if (departure_time < 0)
+        departure_time += week_seconds;
+    const uint32 departure = uint32(departure_time * 1000);
+    const uint32 week_milliseconds = CCompactSpeedProfiles::KWeekMilliseconds;
+    auto arc_cost = [&](uint32 aArc,uint32 aTimeSoFar) -> uint32
+        {
+        uint32 cost = aArcCost.Cost(graph.ArcFlags(aArc),graph.ArcLength(aArc));
+        if (cost == UINT32_MAX)
+            return cost;
+        uint32 week_time = uint32((uint64(departure) + aTimeSoFar) % week_milliseconds);
+        return aSpeedProfiles.TravelTime(aSpeedProfiles.ArcProfile(aArc),week_time,cost);
+        };
+    const uint32 max_speed_percent = aSpeedProfiles.MaxSpeedPercent();
+    TCompactTimeDependentBound<TBound> bound(aBound,max_speed_percent);
+    return aRouter.RouteWithCostFunction(*state,aStart,aEnd,arc_cost,aArcCost.MinCostPerMetre() * 100.0 / max_speed_percent,bound,aTime,aArcPath);
+    }
+
+/** Find the fastest route leaving at a certain time, as above, without a lower bound other than the straight-line distance. */
+inline TResult TimeDependentRoute(CCompactRouter& aRouter,uint32 aStart,uint32 aEnd,double aDepartureTime,
+                                  const TCompactArcCost& aArcCost,const CCompactSpeedProfiles& aSpeedProfiles,
+                                  uint32& aTime,std::vector<uint32>* aArcPath = nullptr)
+    {
+    return TimeDependentRoute(aRouter,aStart,aEnd,aDepartureTime,aArcCost,aSpeedProfiles,TCompactNoCostBound(),aTime,aArcPath);
+    }
+
+}
+
+#endif
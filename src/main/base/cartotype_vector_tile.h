@@ -384,6 +384,24 @@ class CVectorTileServer
     std::shared_ptr<CVectorTile> GetTile(const TTileSpec& aTileSpec,bool aTriggerTileCreation = true);
     bool ForGraphicsAcceleration() const { return m_helper.m_for_graphics_acceleration; }
     bool ProjectTiles() const { return m_helper.m_project_tiles; }
+    /** Return the current generation number of the dynamic data; it is incremented every time the dynamic data tiles are invalidated. */
+    uint32 DynamicDataGeneration() const { return m_dynamic_data_generation; }
+    /**
+    Invalidate the dynamic data tiles if aSnapshotGeneration, the generation of the current snapshot
+    of the dynamic data published by a CSnapshotPublisher, differs from aLastSnapshotGeneration,
+    which is then set to aSnapshotGeneration. The caller owns aLastSnapshotGeneration, which should start at zero.
+    This can be called once per frame by the drawing thread, so that any number of changes published by writer threads
+    between frames cause only one invalidation, while tiles already being drawn continue to use
+    the snapshot they pinned.
+    */
+    void SynchronizeDynamicData(uint32 aSnapshotGeneration,uint32& aLastSnapshotGeneration)
+        {
+        if (aSnapshotGeneration != aLastSnapshotGeneration)
+            {
+            aLastSnapshotGeneration = aSnapshotGeneration;
+            Invalidate(TTileSpec::DynamicDataOnly);
+            }
+        }
 
     static const int32 KImageSizeInPixels = 512;
 